@@ -0,0 +1,111 @@
+/*!
+* \file AllocationTrace.cpp
+* \brief Implementation of @b AllocationTrace.h
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "AllocationTrace.h"
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+
+/**
+* Reads a trace file
+* @param FileName name of the file
+* @return whether the file could be read and makes sense
+*/
+bool AllocationTrace::Read(const char * FileName)
+{
+	std::ifstream file(FileName);
+	if (!file) {
+		std::cerr << FileName << ": can't open" << std::endl;
+		return false;
+	}
+
+	ObjectSize = DEFAULT_OBJECT_SIZE;
+	Blocks = 0;
+	Events.clear();
+
+	std::unordered_map<unsigned long, unsigned> liveBlocks; // id -> block index
+	std::vector<unsigned> freeBlocks;
+	std::string line;
+	for (unsigned lineNumber = 1; std::getline(file, line); ++lineNumber) {
+		size_t comment = line.find('#');
+		if (comment != std::string::npos)
+			line.erase(comment);
+		std::istringstream fields(line);
+		std::string command;
+		unsigned long value;
+		if (!(fields >> command))
+			continue;
+		std::string rest;
+		if (!(fields >> value) || (fields >> rest)) {
+			std::cerr << FileName << ":" << lineNumber << ": expected <command> <number>" << std::endl;
+			return false;
+		}
+
+		if (command == "size") {
+			if (!Events.empty() || value == 0) {
+				std::cerr << FileName << ":" << lineNumber << ": size has to be positive and come first" << std::endl;
+				return false;
+			}
+			ObjectSize = value;
+		}
+		else if (command == "a") {
+			if (liveBlocks.count(value)) {
+				std::cerr << FileName << ":" << lineNumber << ": block " << value << " is already allocated" << std::endl;
+				return false;
+			}
+			unsigned block;
+			if (freeBlocks.empty()) {
+				block = Blocks++;
+			}
+			else {
+				block = freeBlocks.back();
+				freeBlocks.pop_back();
+			}
+			liveBlocks[value] = block;
+			Event event = { block, true };
+			Events.push_back(event);
+		}
+		else if (command == "f") {
+			std::unordered_map<unsigned long, unsigned>::iterator live = liveBlocks.find(value);
+			if (live == liveBlocks.end()) {
+				std::cerr << FileName << ":" << lineNumber << ": block " << value << " isn't allocated" << std::endl;
+				return false;
+			}
+			Event event = { live->second, false };
+			Events.push_back(event);
+			freeBlocks.push_back(live->second);
+			liveBlocks.erase(live);
+		}
+		else {
+			std::cerr << FileName << ":" << lineNumber << ": unknown command " << command << std::endl;
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+* Writes a trace file
+* @param FileName name of the file
+* @return whether the file could be written
+*/
+bool AllocationTrace::Write(const char * FileName) const
+{
+	std::ofstream file(FileName);
+	file << "size " << ObjectSize << "\n";
+	for (size_t i = 0; i < Events.size(); ++i)
+		file << (Events[i].IsAllocation ? "a " : "f ") << Events[i].Block << "\n";
+	file.close();
+	if (!file) {
+		std::cerr << FileName << ": can't write" << std::endl;
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,43 @@
+//---------------------------------------------------------------------------
+#ifndef ALLOCATIONTRACEH
+#define ALLOCATIONTRACEH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+#include <vector>
+
+// Recorded sequence of allocations and frees of one pool, for replaying it in the
+// benchmark and the advisor. The file is text, one entry per line:
+//
+//   # comment
+//   size 48      object size in bytes (optional, before any event, default 64)
+//   a 17         allocate a block and call it 17
+//   f 17         free block 17, the id can be used again afterwards
+//
+// Ids are any unsigned numbers. Reading maps them to dense block indexes, reusing the
+// index of a freed block, so replaying needs an array of Blocks pointers.
+struct AllocationTrace
+{
+	struct Event
+	{
+		unsigned Block;    // dense index, less than Blocks
+		bool IsAllocation;
+	};
+
+	AllocationTrace(void) : ObjectSize(DEFAULT_OBJECT_SIZE), Blocks(0) {}
+
+	static const size_t DEFAULT_OBJECT_SIZE = 64;
+
+	size_t ObjectSize;
+	unsigned Blocks;     // most blocks alive at once
+	std::vector<Event> Events;
+
+	// Reads a trace, prints what's wrong (with the line) to std::cerr and returns false if it's bad.
+	// Blocks still alive at the end are fine, the replay frees them.
+	bool Read(const char *FileName);
+
+	// Writes the trace with the block indexes as ids
+	bool Write(const char *FileName) const;
+};
+
+#endif
@@ -0,0 +1,414 @@
+/*!
+* \file AllocatorControl.cpp
+* \brief Implementation of @b AllocatorControl.h
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "AllocatorControl.h"
+#include "PageHeap.h"
+#include <map>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cerrno>
+
+namespace AllocatorControl
+{
+
+struct Pool
+{
+	ObjectAllocator *allocator;
+	void *lock;
+	LOCKCALLBACK lockFn;
+	ThreadCachedAllocator *cached; // NULL unless registered as a ThreadCachedAllocator
+};
+
+// One <name>.<field>=<value> entry of OA_CONFIG or OA_CONFIG_FILE
+struct Override
+{
+	std::string pool;
+	std::string field;
+	std::string value;
+};
+
+struct Registry
+{
+	std::mutex lock;
+	std::map<std::string, Pool> pools;
+};
+
+/**
+* Helper function to get the registered pools, created on first use and never destroyed
+* so pools can be registered and unregistered during static construction and destruction
+* @return the registry
+*/
+static Registry &registry(void)
+{
+	static Registry* instance = new Registry();
+	return *instance;
+}
+
+/**
+* Helper function to parse an unsigned number, the whole text has to be the number
+* @param text text to be parsed
+* @param number the number (only written on success)
+* @return whether text is a number
+*/
+static bool parse_unsigned(const std::string &text, unsigned &number)
+{
+	if (text.empty() || text[0] == '-')
+		return false;
+	char* end;
+	errno = 0;
+	unsigned long value = strtoul(text.c_str(), &end, 10);
+	if (*end || errno || value > 0xFFFFFFFFul)
+		return false;
+	number = static_cast<unsigned>(value);
+	return true;
+}
+
+/**
+* Helper function to turn a number into text
+* @param number the number
+* @return the text
+*/
+static std::string to_text(size_t number)
+{
+	std::ostringstream text;
+	text << number;
+	return text.str();
+}
+
+/**
+* Helper function to strip spaces and tabs from both ends
+* @param text text to be trimmed
+* @return the trimmed text
+*/
+static std::string trim(const std::string &text)
+{
+	size_t begin = text.find_first_not_of(" \t\r");
+	if (begin == std::string::npos)
+		return std::string();
+	size_t end = text.find_last_not_of(" \t\r");
+	return text.substr(begin, end - begin + 1);
+}
+
+/**
+* Helper function to parse override entries
+* @param text entries separated by any of separators
+* @param separators characters between entries
+* @param source where the entries come from, for warnings
+* @param overrides list the entries are added to
+*/
+static void parse_overrides(const std::string &text, const char *separators, const char *source,
+	std::vector<Override> &overrides)
+{
+	size_t begin = 0;
+	while (begin <= text.size()) {
+		size_t end = text.find_first_of(separators, begin);
+		if (end == std::string::npos)
+			end = text.size();
+		std::string entry = text.substr(begin, end - begin);
+		begin = end + 1;
+
+		size_t comment = entry.find('#');
+		if (comment != std::string::npos)
+			entry.erase(comment);
+		entry = trim(entry);
+		if (entry.empty())
+			continue;
+
+		size_t equals = entry.find('=');
+		size_t dot = entry.rfind('.', equals);
+		if (equals == std::string::npos || dot == std::string::npos || dot == 0) {
+			std::cerr << source << ": ignoring bad entry \"" << entry << "\"" << std::endl;
+			continue;
+		}
+		Override entryOverride;
+		entryOverride.pool = trim(entry.substr(0, dot));
+		entryOverride.field = trim(entry.substr(dot + 1, equals - dot - 1));
+		entryOverride.value = trim(entry.substr(equals + 1));
+		overrides.push_back(entryOverride);
+	}
+}
+
+/**
+* Helper function to read OA_CONFIG_FILE and OA_CONFIG, the first time it's called
+* @return every override entry, in the order they are applied
+*/
+static const std::vector<Override> &get_overrides(void)
+{
+	struct Loader
+	{
+		static std::vector<Override> *load(void)
+		{
+			std::vector<Override>* overrides = new std::vector<Override>();
+			const char* fileName = getenv("OA_CONFIG_FILE");
+			if (fileName && *fileName) {
+				std::ifstream file(fileName);
+				if (file) {
+					std::stringstream contents;
+					contents << file.rdbuf();
+					parse_overrides(contents.str(), "\n", fileName, *overrides);
+				}
+				else {
+					std::cerr << "OA_CONFIG_FILE: can't open " << fileName << std::endl;
+				}
+			}
+			const char* variable = getenv("OA_CONFIG");
+			if (variable)
+				parse_overrides(variable, "\n;", "OA_CONFIG", *overrides);
+			return overrides;
+		}
+	};
+	// Never destroyed, pools can be constructed during static destruction
+	static std::vector<Override>* overrides = Loader::load();
+	return *overrides;
+}
+
+/**
+* Helper function to apply one override entry
+* @param config config to be changed
+* @param entry the override
+* @return whether the field and value were good
+*/
+static bool apply_override(OAConfig &config, const Override &entry)
+{
+	unsigned number;
+	if (!parse_unsigned(entry.value, number))
+		return false;
+
+	bool flag = number != 0;
+	if (entry.field == "use_cpp_mem_manager")
+		config.UseCPPMemManager_ = flag;
+	else if (entry.field == "objects_per_page" && number)
+		config.ObjectsPerPage_ = number;
+	else if (entry.field == "page_bytes")
+		config.PageBytes_ = number;
+	else if (entry.field == "max_pages")
+		config.MaxPages_ = number;
+	else if (entry.field == "debug")
+		config.DebugOn_ = flag;
+	else if (entry.field == "pad_bytes")
+		config.PadBytes_ = number;
+	else if (entry.field == "alignment")
+		config.Alignment_ = number;
+	else if (entry.field == "header_checksum")
+		config.HeaderChecksum_ = flag;
+	else if (entry.field == "reserve_address_space")
+		config.ReserveAddressSpace_ = flag;
+	else if (entry.field == "use_page_heap")
+		config.UsePageHeap_ = flag;
+	else
+		return false;
+	return true;
+}
+
+/**
+* Applies the overrides of a pool to its config
+* @param Name name of the pool
+* @param Config config given by the program
+* @return config with the overrides
+*/
+OAConfig Configure(const char *Name, const OAConfig &Config)
+{
+	OAConfig config = Config;
+	const std::vector<Override>& overrides = get_overrides();
+	// Entries for every pool first, so the ones naming the pool win
+	for (int isNamed = 0; isNamed < 2; ++isNamed) {
+		for (size_t i = 0; i < overrides.size(); ++i) {
+			const Override& entry = overrides[i];
+			if (isNamed ? entry.pool != Name : entry.pool != "*")
+				continue;
+			if (!apply_override(config, entry))
+				std::cerr << "OA_CONFIG: ignoring " << entry.pool << "." << entry.field << "=" << entry.value << std::endl;
+		}
+	}
+	return config;
+}
+
+/**
+* Registers an allocator for Control
+* @param Name name of the pool
+* @param Allocator the allocator
+* @param Lock lock guarding the allocator (NULL if it isn't shared)
+* @param fn called to take (isLocking) and release Lock
+*/
+void Register(const char *Name, ObjectAllocator &Allocator, void *Lock, LOCKCALLBACK fn)
+{
+	Pool pool = { &Allocator, Lock, fn, NULL };
+	Registry& state = registry();
+	std::lock_guard<std::mutex> guard(state.lock);
+	state.pools[Name] = pool;
+}
+
+/**
+* Registers a thread cached allocator for Control, its shared pool is locked while it's controlled
+* @param Name name of the pool
+* @param Allocator the allocator
+*/
+void Register(const char *Name, ThreadCachedAllocator &Allocator)
+{
+	Register(Name, Allocator.Pool());
+	Registry& state = registry();
+	std::lock_guard<std::mutex> guard(state.lock);
+	state.pools[Name].cached = &Allocator;
+}
+
+/**
+* Removes an allocator from Control
+* @param Name name of the pool
+*/
+void Unregister(const char *Name)
+{
+	Registry& state = registry();
+	std::lock_guard<std::mutex> guard(state.lock);
+	state.pools.erase(Name);
+}
+
+/**
+* Helper function that does nothing with corrupted blocks, validate only counts them
+*/
+static void ignore_block(const void *, size_t)
+{
+}
+
+/**
+* Helper function for the pool.<name>.<key> keys, called with the pool locked
+* @param pool the pool
+* @param key the key after pool.<name>.
+* @param Value read value (can be NULL)
+* @param NewValue value to write (can be NULL)
+* @return whether the key exists and allows the access
+*/
+static bool control_pool(Pool &pool, const std::string &key, std::string *Value, const char *NewValue)
+{
+	ObjectAllocator& allocator = *pool.allocator;
+	std::string read;
+	unsigned number = 0;
+	if (NewValue && !parse_unsigned(NewValue, number))
+		return false;
+
+	if (key.compare(0, 6, "stats.") == 0 || key.compare(0, 7, "config.") == 0) {
+		if (NewValue)
+			return false;
+		OAStats stats = allocator.GetStats();
+		OAConfig config = allocator.GetConfig();
+		if (key == "stats.object_size")          read = to_text(stats.ObjectSize_);
+		else if (key == "stats.page_size")       read = to_text(stats.PageSize_);
+		else if (key == "stats.free_objects")    read = to_text(stats.FreeObjects_);
+		else if (key == "stats.objects_in_use")  read = to_text(stats.ObjectsInUse_);
+		else if (key == "stats.pages_in_use")    read = to_text(stats.PagesInUse_);
+		else if (key == "stats.most_objects")    read = to_text(stats.MostObjects_);
+		else if (key == "stats.allocations")     read = to_text(stats.Allocations_);
+		else if (key == "stats.deallocations")   read = to_text(stats.Deallocations_);
+		else if (key == "stats.page_waste")      read = to_text(stats.PageWaste_);
+		else if (key == "config.objects_per_page") read = to_text(config.ObjectsPerPage_);
+		else if (key == "config.pad_bytes")      read = to_text(config.PadBytes_);
+		else if (key == "config.alignment")      read = to_text(config.Alignment_);
+		else if (key == "config.header_size")    read = to_text(config.HBlockInfo_.size_);
+		else if (key == "config.page_bytes")     read = to_text(config.PageBytes_);
+		else
+			return false;
+	}
+	else if (key == "max_pages") {
+		read = to_text(allocator.GetConfig().MaxPages_);
+		if (NewValue)
+			allocator.SetMaxPages(number);
+	}
+	else if (key == "debug") {
+		read = allocator.GetConfig().DebugOn_ ? "1" : "0";
+		if (NewValue)
+			allocator.SetDebugState(number != 0);
+	}
+	else if (key == "auto_sort") {
+		if (!NewValue || Value)
+			return false;
+		allocator.SetAutoSortFreeList(number);
+	}
+	else if (key == "cache_size") {
+		if (!pool.cached)
+			return false;
+		read = to_text(pool.cached->CacheSize());
+		if (NewValue)
+			pool.cached->SetCacheSize(number);
+	}
+	else if (key == "trim")
+		read = to_text(allocator.FreeEmptyPages());
+	else if (key == "validate")
+		read = to_text(allocator.ValidatePages(ignore_block));
+	else if (key == "sort")
+		read = to_text(allocator.SortFreeList());
+	else if (key == "zero")
+		read = to_text(allocator.ZeroFreeObjects());
+	else
+		return false;
+
+	if (Value)
+		*Value = read;
+	return true;
+}
+
+/**
+* Reads and/or writes a value by key
+* @param Key the key (see AllocatorControl.h)
+* @param Value read value (NULL to only write)
+* @param NewValue value to write (NULL to only read)
+* @return whether the key exists and allows the access
+*/
+bool Control(const char *Key, std::string *Value, const char *NewValue)
+{
+	std::string key = Key;
+	if (key == "page_heap.footprint" || key == "page_heap.in_use") {
+		if (NewValue)
+			return false;
+		if (Value)
+			*Value = to_text(key == "page_heap.footprint" ? PageHeap::Footprint() : PageHeap::BytesInUse());
+		return true;
+	}
+
+	Registry& state = registry();
+	std::lock_guard<std::mutex> guard(state.lock);
+	if (key == "pools") {
+		if (NewValue)
+			return false;
+		if (Value) {
+			Value->clear();
+			for (std::map<std::string, Pool>::iterator i = state.pools.begin(); i != state.pools.end(); ++i) {
+				if (!Value->empty())
+					*Value += ",";
+				*Value += i->first;
+			}
+		}
+		return true;
+	}
+
+	// pool.<name>.<key>, names can have dots so try the longest registered one that matches
+	if (key.compare(0, 5, "pool.") != 0)
+		return false;
+	for (size_t dot = key.rfind('.'); dot != std::string::npos && dot > 5; dot = key.rfind('.', dot - 1)) {
+		std::map<std::string, Pool>::iterator pool = state.pools.find(key.substr(5, dot - 5));
+		if (pool == state.pools.end())
+			continue;
+		if (pool->second.lockFn)
+			pool->second.lockFn(pool->second.lock, true);
+		bool isDone;
+		try {
+			isDone = control_pool(pool->second, key.substr(dot + 1), Value, NewValue);
+		}
+		catch (...) {
+			if (pool->second.lockFn)
+				pool->second.lockFn(pool->second.lock, false);
+			throw;
+		}
+		if (pool->second.lockFn)
+			pool->second.lockFn(pool->second.lock, false);
+		return isDone;
+	}
+	return false;
+}
+
+}
@@ -0,0 +1,74 @@
+//---------------------------------------------------------------------------
+#ifndef ALLOCATORCONTROLH
+#define ALLOCATORCONTROLH
+//---------------------------------------------------------------------------
+
+#include "ThreadCachedAllocator.h"
+#include <string>
+
+// Tuning and introspection of running allocators by name, in the spirit of mallctl:
+//
+//   AllocatorControl::Register("employees", pool);
+//   std::string value;
+//   AllocatorControl::Control("pool.employees.stats.objects_in_use", &value);
+//   AllocatorControl::Control("pool.employees.max_pages", NULL, "64");
+//
+// Keys (rw = can be written, actions run whenever the key is used):
+//   pools                                  names of the registered pools, comma separated
+//   page_heap.footprint, page_heap.in_use  PageHeap::Footprint/BytesInUse
+//   pool.<name>.stats.<stat>               object_size, page_size, free_objects, objects_in_use,
+//                                          pages_in_use, most_objects, allocations, deallocations,
+//                                          page_waste
+//   pool.<name>.config.<field>             objects_per_page, pad_bytes, alignment, header_size,
+//                                          page_bytes
+//   pool.<name>.max_pages                  rw, SetMaxPages
+//   pool.<name>.debug                      rw, SetDebugState (0/1)
+//   pool.<name>.auto_sort                  write only, SetAutoSortFreeList
+//   pool.<name>.cache_size                 rw, ThreadCachedAllocator::SetCacheSize (thread cached pools only)
+//   pool.<name>.trim                       action, FreeEmptyPages, reads the pages freed
+//   pool.<name>.validate                   action, ValidatePages, reads the blocks found corrupted
+//   pool.<name>.sort                       action, SortFreeList, reads the free blocks
+//   pool.<name>.zero                       action, ZeroFreeObjects, reads the blocks zeroed
+//
+// OAConfig overrides are read once, from the file named by OA_CONFIG_FILE and then from
+// the OA_CONFIG environment variable (so the variable wins). Both hold <name>.<field>=<value>
+// entries, separated by newlines or ';' in the variable; '#' starts a comment, and the
+// name * applies to every pool. Fields: use_cpp_mem_manager, objects_per_page, max_pages,
+// debug, pad_bytes, alignment, header_checksum, reserve_address_space, use_page_heap,
+// page_bytes (0 goes back to objects_per_page).
+// All functions are thread safe.
+namespace AllocatorControl
+{
+	typedef void(*LOCKCALLBACK)(void *Lock, bool isLocking);
+
+	// Makes an allocator reachable under pool.<Name>. Lock/fn guard it while it's controlled.
+	// Unregister before destroying it. Registering a name again replaces the old pool.
+	void Register(const char *Name, ObjectAllocator &Allocator, void *Lock = 0, LOCKCALLBACK fn = 0);
+	void Register(const char *Name, ThreadCachedAllocator &Allocator);
+	void Unregister(const char *Name);
+
+	template <typename LockPolicy>
+	void Register(const char *Name, SynchronizedObjectAllocator<LockPolicy> &Allocator)
+	{
+		struct Locker
+		{
+			static void lock(void *Lock, bool isLocking)
+			{
+				if (isLocking)
+					static_cast<LockPolicy*>(Lock)->lock();
+				else
+					static_cast<LockPolicy*>(Lock)->unlock();
+			}
+		};
+		Register(Name, Allocator.Unsynchronized(), &Allocator.Lock(), &Locker::lock);
+	}
+
+	// Reads the value of Key into Value (if not NULL), then writes NewValue (if not NULL).
+	// Returns false if the key doesn't exist, can't be read or written, or NewValue is bad.
+	bool Control(const char *Key, std::string *Value, const char *NewValue = 0);
+
+	// Config with the overrides for pool Name applied, use it to construct the pool
+	OAConfig Configure(const char *Name, const OAConfig &Config);
+}
+
+#endif
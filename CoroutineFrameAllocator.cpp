@@ -0,0 +1,80 @@
+/*!
+* \file CoroutineFrameAllocator.cpp
+* \brief Implementation of @b CoroutineFrameAllocator.h
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "CoroutineFrameAllocator.h"
+#include <new>
+
+// Pages hold about this many bytes of frames
+static const size_t FRAME_PAGE_SIZE = 64 * 1024;
+
+// One pool per size class, never destroyed so frames can be freed during static destruction
+static std::atomic<ThreadCachedAllocator *> framePools[CoroutineFrameAllocator::SIZE_CLASS_COUNT];
+
+/**
+* @brief Finds (or creates) the pool for a frame size
+* @param size size of the frame
+* @return pool for the frame, or 0 when the frame is too big to be pooled
+*/
+ThreadCachedAllocator *CoroutineFrameAllocator::Pool(size_t size)
+{
+	if (size > MAX_POOLED_SIZE)
+		return 0;
+
+	size_t sizeClass = size ? (size - 1) / SIZE_CLASS_STEP : 0;
+	ThreadCachedAllocator *pool = framePools[sizeClass].load(std::memory_order_acquire);
+	if (pool)
+		return pool;
+
+	size_t frameSize = (sizeClass + 1) * SIZE_CLASS_STEP;
+	unsigned framesPerPage = static_cast<unsigned>(FRAME_PAGE_SIZE / frameSize);
+	ThreadCachedAllocator *created = new ThreadCachedAllocator(frameSize,
+		OAConfig(false, framesPerPage, 0, false, 0, OAConfig::HeaderBlockInfo(), SIZE_CLASS_STEP));
+
+	// Another thread may have created the pool at the same time, keep the first one
+	if (!framePools[sizeClass].compare_exchange_strong(pool, created, std::memory_order_acq_rel)) {
+		delete created;
+		return pool;
+	}
+	return created;
+}
+
+/**
+* @brief Gets a frame from the pool of its size class
+* @param size size of the frame
+* @return the frame
+*/
+void *CoroutineFrameAllocator::Allocate(size_t size)
+{
+	// Creating the pool can fail too
+	try {
+		ThreadCachedAllocator *pool = Pool(size);
+		if (!pool)
+			return ::operator new(size);
+		return pool->Allocate();
+	}
+	catch (OAException &) {
+		throw std::bad_alloc();
+	}
+}
+
+/**
+* @brief Gives a frame back to the pool of its size class
+* @param frame the frame
+* @param size size of the frame (as passed to Allocate)
+*/
+void CoroutineFrameAllocator::Free(void *frame, size_t size)
+{
+	if (!frame)
+		return;
+
+	ThreadCachedAllocator *pool = Pool(size);
+	if (pool)
+		pool->Free(frame);
+	else
+		::operator delete(frame);
+}
@@ -0,0 +1,49 @@
+//---------------------------------------------------------------------------
+#ifndef COROUTINEFRAMEALLOCATORH
+#define COROUTINEFRAMEALLOCATORH
+//---------------------------------------------------------------------------
+
+#include "ThreadCachedAllocator.h"
+
+// Pools for coroutine frames. The frame of one coroutine function always has the same
+// size, so frames are rounded up to a size class and every class gets its own
+// ThreadCachedAllocator, created the first time a frame of that class is allocated.
+// Frames bigger than the largest class come from the global new/delete.
+class CoroutineFrameAllocator
+{
+public:
+	static const size_t SIZE_CLASS_STEP = 16;   // size classes are multiples of this (and frames aligned to it)
+	static const size_t SIZE_CLASS_COUNT = 256; // so the largest pooled frame is 4 KiB
+	static const size_t MAX_POOLED_SIZE = SIZE_CLASS_STEP * SIZE_CLASS_COUNT;
+
+	// Gets a frame of at least size bytes
+	// Throws std::bad_alloc if no memory is available
+	static void *Allocate(size_t size);
+
+	// Gives back a frame from Allocate, size must be the same as in that call
+	static void Free(void *frame, size_t size);
+
+	// The pool for frames of size bytes (0 if such frames aren't pooled)
+	static ThreadCachedAllocator *Pool(size_t size);
+};
+
+// Base for coroutine promise types, so their frames come from CoroutineFrameAllocator:
+//
+//   struct promise_type : PooledFramePromise { ... };
+//
+// The compiler allocates a frame with the promise type's operator new and frees it with
+// the sized operator delete, which tells us which pool it came from.
+struct PooledFramePromise
+{
+	static void *operator new(size_t size)
+	{
+		return CoroutineFrameAllocator::Allocate(size);
+	}
+
+	static void operator delete(void *frame, size_t size)
+	{
+		CoroutineFrameAllocator::Free(frame, size);
+	}
+};
+
+#endif
@@ -0,0 +1,177 @@
+/*!
+* \file IOBufferPool.cpp
+* \brief Implementation of @b IOBufferPool.h
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "IOBufferPool.h"
+#include <new>
+
+// Records share pages of about this many
+static const unsigned RECORDS_PER_PAGE = 64;
+
+// Most buffers ReleaseBatch gives back under one lock
+static const unsigned RELEASE_CHUNK = 64;
+
+/**
+* @brief Constructor for IOBufferPool class
+* @param BufferSize size of every buffer (rounded up to IO_ALIGNMENT)
+* @param BuffersPerPage buffers in one page of the buffer allocator
+* @param MaxPages most pages of buffers, 0 for no limit
+*/
+IOBufferPool::IOBufferPool(size_t BufferSize, unsigned BuffersPerPage, unsigned MaxPages) :
+	bufferSize(BufferSize ? (BufferSize + IO_ALIGNMENT - 1) / IO_ALIGNMENT * IO_ALIGNMENT : IO_ALIGNMENT),
+	buffers(bufferSize, OAConfig(false, BuffersPerPage, MaxPages, false, 0, OAConfig::HeaderBlockInfo(), IO_ALIGNMENT)),
+	records(sizeof(IOBuffer), OAConfig(false, RECORDS_PER_PAGE, 0))
+{
+}
+
+/**
+* @brief Gets an empty buffer with one owner
+* @return the buffer
+*/
+IOBuffer * IOBufferPool::Acquire(void)
+{
+	IOBuffer* buffer;
+	AcquireBatch(&buffer, 1);
+	return buffer;
+}
+
+/**
+* @brief Adds an owner to a buffer
+* @param buffer the buffer
+*/
+void IOBufferPool::Retain(IOBuffer * buffer)
+{
+	buffer->refs.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+* @brief Removes an owner from a buffer, the last one gives it back to its pool
+* @param buffer the buffer
+*/
+void IOBufferPool::Release(IOBuffer * buffer)
+{
+	if (buffer->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		buffer->owner->give_back(buffer);
+}
+
+/**
+* @brief Gets a number of buffers, each with one owner
+* @param buffers where the buffers are written
+* @param count number of buffers
+*/
+void IOBufferPool::AcquireBatch(IOBuffer ** buffers, unsigned count)
+{
+	unsigned dataCount = 0;
+	unsigned recordCount = 0;
+	try {
+		{
+			std::lock_guard<MutexLock> guard(this->buffers.Lock());
+			ObjectAllocator &allocator = this->buffers.Unsynchronized();
+			// The data pointers wait in the output array until the records are there
+			for (; dataCount < count; ++dataCount)
+				buffers[dataCount] = static_cast<IOBuffer*>(allocator.Allocate());
+		}
+
+		std::lock_guard<MutexLock> guard(records.Lock());
+		ObjectAllocator &allocator = records.Unsynchronized();
+		for (; recordCount < count; ++recordCount) {
+			unsigned char* data = reinterpret_cast<unsigned char*>(buffers[recordCount]);
+			IOBuffer* buffer = new (allocator.Allocate()) IOBuffer();
+			buffer->Data = data;
+			buffer->Capacity = bufferSize;
+			buffer->Length = 0;
+			buffer->refs.store(1, std::memory_order_relaxed);
+			buffer->owner = this;
+			buffers[recordCount] = buffer;
+		}
+	}
+	catch (OAException &) {
+		// Give back everything, so the caller either gets all buffers or none. Through the
+		// wrappers, someone may be waiting in AllocateWait for a buffer.
+		for (unsigned i = 0; i < recordCount; ++i) {
+			unsigned char* data = buffers[i]->Data;
+			records.Free(buffers[i]);
+			buffers[i] = reinterpret_cast<IOBuffer*>(data);
+		}
+		for (unsigned i = 0; i < dataCount; ++i)
+			this->buffers.Free(buffers[i]);
+		throw;
+	}
+}
+
+/**
+* @brief Removes an owner from a number of buffers
+* @param buffers the buffers
+* @param count number of buffers
+*/
+void IOBufferPool::ReleaseBatch(IOBuffer ** buffers, unsigned count)
+{
+	// Buffers that lost their last owner are collected, a chunk at a time
+	void* unownedData[RELEASE_CHUNK];
+	void* unownedRecords[RELEASE_CHUNK];
+	unsigned i = 0;
+	while (i < count) {
+		unsigned unownedCount = 0;
+		for (; i < count && unownedCount < RELEASE_CHUNK; ++i) {
+			if (buffers[i]->owner != this) {
+				Release(buffers[i]);
+			}
+			else if (buffers[i]->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				unownedData[unownedCount] = buffers[i]->Data;
+				buffers[i]->~IOBuffer();
+				unownedRecords[unownedCount++] = buffers[i];
+			}
+		}
+		if (!unownedCount)
+			continue;
+
+		// FreeBatch wakes up AllocateWait/AllocateFor on the buffers
+		this->buffers.FreeBatch(unownedData, unownedCount);
+		records.FreeBatch(unownedRecords, unownedCount);
+	}
+}
+
+#ifndef _WIN32
+/**
+* @brief Points vectors at the whole capacity of buffers
+* @param buffers the buffers
+* @param vectors where the vectors are written
+* @param count number of buffers
+*/
+void IOBufferPool::FillReadIovec(IOBuffer * const * buffers, struct iovec * vectors, unsigned count)
+{
+	for (unsigned i = 0; i < count; ++i) {
+		vectors[i].iov_base = buffers[i]->Data;
+		vectors[i].iov_len = buffers[i]->Capacity;
+	}
+}
+
+/**
+* @brief Points vectors at the bytes in use of buffers
+* @param buffers the buffers
+* @param vectors where the vectors are written
+* @param count number of buffers
+*/
+void IOBufferPool::FillWriteIovec(IOBuffer * const * buffers, struct iovec * vectors, unsigned count)
+{
+	for (unsigned i = 0; i < count; ++i) {
+		vectors[i].iov_base = buffers[i]->Data;
+		vectors[i].iov_len = buffers[i]->Length;
+	}
+}
+#endif
+
+/**
+* Helper function to give a buffer without owners back to the pool
+* @param buffer the buffer
+*/
+void IOBufferPool::give_back(IOBuffer * buffer)
+{
+	buffers.Free(buffer->Data);
+	buffer->~IOBuffer();
+	records.Free(buffer);
+}
@@ -0,0 +1,80 @@
+//---------------------------------------------------------------------------
+#ifndef IOBUFFERPOOLH
+#define IOBUFFERPOOLH
+//---------------------------------------------------------------------------
+
+#include "SynchronizedObjectAllocator.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+class IOBufferPool;
+
+// A buffer from an IOBufferPool. Data is aligned to IOBufferPool::IO_ALIGNMENT and
+// Capacity is a multiple of it, so it can be used with O_DIRECT. Several owners can
+// share the buffer instead of copying it: every one of them calls Retain, and the
+// buffer goes back to the pool when the last one calls Release.
+struct IOBuffer
+{
+	unsigned char *Data;          // the bytes
+	size_t Capacity;              // size of Data
+	size_t Length;                // bytes in use (what FillIovec hands to writev)
+	std::atomic<unsigned> refs;   // owners of the buffer
+	IOBufferPool *owner;          // pool to give the buffer back to
+};
+
+// Pool of fixed size I/O buffers. The buffers themselves come from an ObjectAllocator
+// with page aligned blocks, their IOBuffer records from a second one, and both are
+// shared between threads.
+class IOBufferPool
+{
+public:
+	static const size_t IO_ALIGNMENT = 4096;          // alignment and size granularity of buffers
+	static const unsigned DEFAULT_BUFFERS_PER_PAGE = 16;
+
+	// BufferSize is rounded up to a multiple of IO_ALIGNMENT. MaxPages 0 means no limit.
+	IOBufferPool(size_t BufferSize, unsigned BuffersPerPage = DEFAULT_BUFFERS_PER_PAGE, unsigned MaxPages = 0);
+
+	// Gets an empty buffer with one owner
+	// Throws an exception if no buffer can be provided. (Memory allocation problem)
+	IOBuffer *Acquire(void);
+
+	// Adds an owner to the buffer
+	static void Retain(IOBuffer *buffer);
+
+	// Removes an owner from the buffer, the last one gives it back to the pool
+	static void Release(IOBuffer *buffer);
+
+	// Gets count buffers (or none of them, on an exception) with one lock for each allocator
+	void AcquireBatch(IOBuffer **buffers, unsigned count);
+
+	// Releases count buffers, the ones going back to the pool with one lock for each allocator
+	void ReleaseBatch(IOBuffer **buffers, unsigned count);
+
+#ifndef _WIN32
+	// Points vectors at the whole capacity of every buffer (for readv)
+	static void FillReadIovec(IOBuffer *const *buffers, struct iovec *vectors, unsigned count);
+
+	// Points vectors at the first Length bytes of every buffer (for writev)
+	static void FillWriteIovec(IOBuffer *const *buffers, struct iovec *vectors, unsigned count);
+#endif
+
+	size_t BufferSize(void) const { return bufferSize; }
+
+	// The allocator of the buffer memory, for stats and debugging
+	SynchronizedObjectAllocator<MutexLock> &Buffers(void) { return buffers; }
+
+private:
+	size_t bufferSize;
+	SynchronizedObjectAllocator<MutexLock> buffers; // page aligned data
+	SynchronizedObjectAllocator<MutexLock> records; // IOBuffer records
+
+	void give_back(IOBuffer *buffer);
+
+	// Make private to prevent copy construction and assignment
+	IOBufferPool(const IOBufferPool &);
+	IOBufferPool &operator=(const IOBufferPool &);
+};
+
+#endif
@@ -0,0 +1,399 @@
+/*!
+* \file OAPreload.cpp
+* \brief malloc/free/operator new/operator delete replacement built on ObjectAllocator pools
+*
+* \copyright Digipen Institute of Technology
+*
+* Build with "make preload" and run any program with LD_PRELOAD=./liboapreload.so.
+* Requests up to MAX_POOLED_SIZE bytes go to one ThreadCachedAllocator per 16-byte
+* size class, everything else goes to glibc. Set OA_PRELOAD_STATS=1 to print the
+* pool stats when the program exits. fork is safe while other threads allocate, every
+* pool lock is held across it. Linux/glibc only.
+*
+*/
+
+#include "ThreadCachedAllocator.h"
+#include "PageMap.h"
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <dlfcn.h>
+
+// glibc's own allocator, always available under these names
+extern "C" {
+	void *__libc_malloc(size_t size);
+	void *__libc_calloc(size_t count, size_t size);
+	void *__libc_realloc(void *pointer, size_t size);
+	void __libc_free(void *pointer);
+}
+
+static const size_t SIZE_CLASS_STEP = 16;  // also the alignment of every pooled block
+static const size_t MAX_POOLED_SIZE = 256;
+static const size_t SIZE_CLASSES = MAX_POOLED_SIZE / SIZE_CLASS_STEP;
+static const size_t TARGET_PAGE_SIZE = 64 * 1024;
+static const size_t ARENA_CHUNK = 4096;
+static const size_t ARENA_SIZE = sizeof(void*) == 8 ? (static_cast<size_t>(16) << 30) : (static_cast<size_t>(256) << 20);
+
+// Everything the pools allocate for themselves (pages, page map levels...) comes from
+// this arena in whole 4 KiB chunks. So a pointer inside the arena is either a pooled
+// block or pool bookkeeping, and no chunk is ever shared with glibc's memory.
+static unsigned char *arenaBegin;
+static std::atomic<size_t> arenaUsed(0);
+static std::atomic<int> arenaState(0); // 0=not reserved, 1=reserving, 2=ready, 3=failed
+
+// Set while this thread is inside the pools, nested allocations go to the arena
+static __thread bool insidePool __attribute__((tls_model("initial-exec")));
+
+static ThreadCachedAllocator *pools[SIZE_CLASSES];
+static std::atomic<bool> poolsReady[SIZE_CLASSES];
+static SpinLock poolsLock;
+alignas(ThreadCachedAllocator) static unsigned char poolStorage[SIZE_CLASSES][sizeof(ThreadCachedAllocator)];
+
+/**
+* Reserves the arena the first time it's needed
+* @return whether the arena can be used
+*/
+static bool arena_ready(void)
+{
+	int state = arenaState.load(std::memory_order_acquire);
+	if (state == 2)
+		return true;
+	if (state == 3)
+		return false;
+
+	int expected = 0;
+	if (arenaState.compare_exchange_strong(expected, 1)) {
+		void* reserved = mmap(NULL, ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+		arenaBegin = reserved == MAP_FAILED ? NULL : static_cast<unsigned char*>(reserved);
+		arenaState.store(arenaBegin ? 2 : 3, std::memory_order_release);
+	}
+	while ((state = arenaState.load(std::memory_order_acquire)) == 1)
+		CpuRelax();
+	return state == 2;
+}
+
+/**
+* Carves memory for the pools out of the arena
+* @param size bytes needed
+* @return the memory or NULL when the arena is used up
+*/
+static void *arena_allocate(size_t size)
+{
+	if (!arena_ready())
+		return NULL;
+	size_t rounded = (size + ARENA_CHUNK - 1) & ~(ARENA_CHUNK - 1);
+	size_t offset = arenaUsed.fetch_add(rounded);
+	if (offset + rounded > ARENA_SIZE)
+		return NULL;
+	return arenaBegin + offset;
+}
+
+/**
+* Checks whether a pointer came from the arena
+* @param pointer pointer to be checked
+* @return whether it's in the arena
+*/
+static bool is_in_arena(const void *pointer)
+{
+	const unsigned char* address = static_cast<const unsigned char*>(pointer);
+	return arenaBegin && address >= arenaBegin && address < arenaBegin + ARENA_SIZE;
+}
+
+/**
+* Finds (or creates) the pool for a size, must be called with insidePool set
+* @param size bytes requested
+* @return the pool or NULL if it can't be created
+*/
+static ThreadCachedAllocator *pool_for_size(size_t size)
+{
+	size_t sizeClass = (size + SIZE_CLASS_STEP - 1) / SIZE_CLASS_STEP - 1;
+	if (poolsReady[sizeClass].load(std::memory_order_acquire))
+		return pools[sizeClass];
+
+	std::lock_guard<SpinLock> guard(poolsLock);
+	if (!poolsReady[sizeClass].load(std::memory_order_relaxed)) {
+		size_t objectSize = (sizeClass + 1) * SIZE_CLASS_STEP;
+		unsigned objectsPerPage = static_cast<unsigned>((TARGET_PAGE_SIZE - SIZE_CLASS_STEP) / objectSize);
+		OAConfig config(false, objectsPerPage, 0, false, 0, OAConfig::HeaderBlockInfo(), static_cast<unsigned>(SIZE_CLASS_STEP));
+		try {
+			// Never destroyed, other threads' caches may still hold blocks at exit
+			pools[sizeClass] = new (poolStorage[sizeClass]) ThreadCachedAllocator(objectSize, config);
+		}
+		catch (...) {
+			return NULL;
+		}
+		poolsReady[sizeClass].store(true, std::memory_order_release);
+	}
+	return pools[sizeClass];
+}
+
+/**
+* Finds the pool a pointer from the arena belongs to
+* @param pointer pointer in the arena
+* @return the pool or NULL for pool bookkeeping memory
+*/
+static ThreadCachedAllocator *pool_for_pointer(const void *pointer)
+{
+	ObjectAllocator* owner = PageMap::Find(pointer);
+	if (!owner)
+		return NULL;
+	for (size_t i = 0; i < SIZE_CLASSES; ++i) {
+		if (poolsReady[i].load(std::memory_order_acquire) && &pools[i]->Pool().Unsynchronized() == owner)
+			return pools[i];
+	}
+	return NULL;
+}
+
+/**
+* Allocation entry point for malloc and operator new
+* @param size bytes requested
+* @return the memory or NULL
+*/
+static void *oa_malloc(size_t size)
+{
+	if (insidePool) {
+		void* memory = arena_allocate(size);
+		return memory ? memory : __libc_malloc(size);
+	}
+	if (size > MAX_POOLED_SIZE || !arena_ready())
+		return __libc_malloc(size);
+
+	void* memory = NULL;
+	insidePool = true;
+	ThreadCachedAllocator* pool = pool_for_size(size ? size : 1);
+	if (pool) {
+		try {
+			memory = pool->Allocate();
+		}
+		catch (...) {
+			memory = NULL;
+		}
+	}
+	insidePool = false;
+	return memory ? memory : __libc_malloc(size);
+}
+
+/**
+* Deallocation entry point for free and operator delete
+* @param pointer memory to be freed
+*/
+static void oa_free(void *pointer)
+{
+	if (!pointer)
+		return;
+	if (!is_in_arena(pointer)) {
+		__libc_free(pointer);
+		return;
+	}
+	// Pool bookkeeping memory stays in the arena
+	if (insidePool)
+		return;
+
+	insidePool = true;
+	ThreadCachedAllocator* pool = pool_for_pointer(pointer);
+	if (pool)
+		pool->Free(pointer);
+	insidePool = false;
+}
+
+/**
+* Usable size of a pooled block
+* @param pointer pointer in the arena
+* @return size of its size class (0 for bookkeeping memory)
+*/
+static size_t pooled_size(const void *pointer)
+{
+	ThreadCachedAllocator* pool = pool_for_pointer(pointer);
+	return pool ? pool->Pool().Unsynchronized().GetStats().ObjectSize_ : 0;
+}
+
+extern "C" {
+
+void *malloc(size_t size) noexcept
+{
+	return oa_malloc(size);
+}
+
+void free(void *pointer) noexcept
+{
+	oa_free(pointer);
+}
+
+void *calloc(size_t count, size_t size) noexcept
+{
+	size_t total = count * size;
+	if (size && total / size != count)
+		return NULL;
+	if (total > MAX_POOLED_SIZE || insidePool)
+		return __libc_calloc(count, size);
+
+	void* memory = oa_malloc(total);
+	if (memory)
+		memset(memory, 0, total);
+	return memory;
+}
+
+void *realloc(void *pointer, size_t size) noexcept
+{
+	if (!pointer)
+		return oa_malloc(size);
+	if (!is_in_arena(pointer))
+		return __libc_realloc(pointer, size);
+	if (size == 0) {
+		oa_free(pointer);
+		return NULL;
+	}
+
+	insidePool = true;
+	size_t oldSize = pooled_size(pointer);
+	insidePool = false;
+	// Still fits and isn't a much smaller class
+	if (size <= oldSize && size + SIZE_CLASS_STEP > oldSize)
+		return pointer;
+
+	void* memory = oa_malloc(size);
+	if (memory) {
+		memcpy(memory, pointer, size < oldSize ? size : oldSize);
+		oa_free(pointer);
+	}
+	return memory;
+}
+
+void *reallocarray(void *pointer, size_t count, size_t size) noexcept
+{
+	size_t total = count * size;
+	if (size && total / size != count)
+		return NULL;
+	return realloc(pointer, total);
+}
+
+size_t malloc_usable_size(void *pointer) noexcept
+{
+	if (!pointer)
+		return 0;
+	if (is_in_arena(pointer)) {
+		insidePool = true;
+		size_t size = pooled_size(pointer);
+		insidePool = false;
+		return size;
+	}
+
+	typedef size_t (*USABLESIZEFN)(void *);
+	static USABLESIZEFN libcUsableSize = reinterpret_cast<USABLESIZEFN>(dlsym(RTLD_NEXT, "malloc_usable_size"));
+	return libcUsableSize ? libcUsableSize(pointer) : 0;
+}
+
+}
+
+// operator new/delete go straight to the pools instead of through malloc
+
+void *operator new(size_t size)
+{
+	void* memory = oa_malloc(size);
+	if (!memory)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void *operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return oa_malloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return oa_malloc(size);
+}
+
+void operator delete(void *pointer) noexcept
+{
+	oa_free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+	oa_free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+	oa_free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+	oa_free(pointer);
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept
+{
+	oa_free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept
+{
+	oa_free(pointer);
+}
+
+/**
+* Takes every pool lock before fork, so the child can't inherit a lock held by a
+* thread that doesn't exist there
+*/
+static void lock_pools_for_fork(void)
+{
+	poolsLock.lock();
+	// No pool can be created while poolsLock is held
+	for (size_t i = 0; i < SIZE_CLASSES; ++i) {
+		if (poolsReady[i].load(std::memory_order_acquire))
+			pools[i]->Pool().Lock().lock();
+	}
+}
+
+/**
+* Releases the locks lock_pools_for_fork took, in the parent and in the child
+*/
+static void unlock_pools_after_fork(void)
+{
+	for (size_t i = SIZE_CLASSES; i-- > 0; ) {
+		if (poolsReady[i].load(std::memory_order_acquire))
+			pools[i]->Pool().Lock().unlock();
+	}
+	poolsLock.unlock();
+}
+
+/**
+* Installs the fork handlers when the library is loaded
+*/
+__attribute__((constructor)) static void install_fork_handlers(void)
+{
+	pthread_atfork(lock_pools_for_fork, unlock_pools_after_fork, unlock_pools_after_fork);
+}
+
+/**
+* Prints the stats of every pool at exit when OA_PRELOAD_STATS is set
+*/
+__attribute__((destructor)) static void print_pool_stats(void)
+{
+	const char* showStats = getenv("OA_PRELOAD_STATS");
+	if (!showStats || *showStats != '1')
+		return;
+
+	for (size_t i = 0; i < SIZE_CLASSES; ++i) {
+		if (!poolsReady[i].load(std::memory_order_acquire))
+			continue;
+		OAStats stats = pools[i]->Pool().GetStats();
+		fprintf(stderr, "oa: %4u bytes: pages %u, in use %u (most %u), allocs %u, frees %u\n",
+			static_cast<unsigned>(stats.ObjectSize_), stats.PagesInUse_, stats.ObjectsInUse_,
+			stats.MostObjects_, stats.Allocations_, stats.Deallocations_);
+	}
+	fprintf(stderr, "oa: arena %u KiB\n", static_cast<unsigned>(arenaUsed.load() / 1024));
+}
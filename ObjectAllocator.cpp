@@ -10,48 +10,215 @@
 */
 
 #include "ObjectAllocator.h"
+#include "PageMap.h"
+#include "PageHeap.h"
 #include <iostream>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <algorithm>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#elif defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
 
 using std::cout;
 using std::endl;
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define OA_HAS_CRC32_INSTRUCTION
+#endif
+
+// Poisoning for AddressSanitizer and Valgrind memcheck, turned on by building with
+// -DOA_POISON_MEMORY (and -fsanitize=address for ASan). While debugging is off, the
+// bodies of free blocks (past the free list link) and the pads and alignment bytes
+// around blocks are marked as inaccessible, so the tools report a use after free or
+// an overflow at the access that does it. Headers stay accessible since the allocator
+// reads them itself. Valgrind sees unpoisoned blocks as defined, so AllocateZeroed's
+// blocks don't look uninitialized.
+#if defined(OA_POISON_MEMORY) && defined(__SANITIZE_ADDRESS__)
+#define OA_ASAN_POISONING
+#elif defined(OA_POISON_MEMORY) && defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define OA_ASAN_POISONING
+#endif
+#endif
+
+#if defined(OA_ASAN_POISONING)
+#include <sanitizer/asan_interface.h>
+#define OA_POISON(address, size) ASAN_POISON_MEMORY_REGION(address, size)
+#define OA_UNPOISON(address, size) ASAN_UNPOISON_MEMORY_REGION(address, size)
+#elif defined(OA_POISON_MEMORY)
+#include <valgrind/memcheck.h>
+#define OA_POISON(address, size) VALGRIND_MAKE_MEM_NOACCESS(address, size)
+#define OA_UNPOISON(address, size) VALGRIND_MAKE_MEM_DEFINED(address, size)
+#else
+#define OA_NO_POISONING
+#define OA_POISON(address, size) ((void)(address), (void)(size))
+#define OA_UNPOISON(address, size) ((void)(address), (void)(size))
+#endif
+
+// The soft-dirty bits are cleared for the whole process, so allocators take turns with
+// ValidateDirtyPages and count the clears to notice when their bits were reset by another
+#ifdef __linux__
+static std::mutex softDirtyLock;
+static unsigned long softDirtyGeneration = 0; // guarded by softDirtyLock
+#endif
+
+// Address space reserved when OAConfig::MaxPages_ is 0 (unlimited)
+static const size_t DEFAULT_RESERVED_BYTES = sizeof(void*) >= 8 ? (static_cast<size_t>(1) << 34) : (static_cast<size_t>(1) << 28);
+
 #define OUT_OF_LOGICAL_MEMORY_ERROR "Cannot allocate new page - max pages has been reached"
 #define OUT_OF_PHYSICAL_MEMORY_ERROR "Cannot allocate new page - out of physical memory: " + std::string(e.what())
 
+// Byte table of the software CRC32C
+struct Crc32cTable
+{
+	unsigned entries[256];
+
+	Crc32cTable(void)
+	{
+		for (unsigned i = 0; i < 256; ++i) {
+			unsigned crc = i;
+			for (int bit = 0; bit < 8; ++bit)
+				crc = (crc & 1) ? (crc >> 1) ^ 0x82F63B78u : (crc >> 1);
+			entries[i] = crc;
+		}
+	}
+};
+
+/**
+* Software CRC32C (Castagnoli), used when the crc32 instruction isn't available
+* @param data Bytes to checksum
+* @param size Number of bytes
+* @return checksum of the bytes
+*/
+static unsigned crc32c_software(const unsigned char* data, size_t size)
+{
+	// Built by the first caller, the free worker and the owner can both get here first
+	static const Crc32cTable table;
+
+	unsigned crc = 0xFFFFFFFFu;
+	while (size--)
+		crc = table.entries[(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+	return ~crc;
+}
+
+#ifdef OA_HAS_CRC32_INSTRUCTION
+/**
+* CRC32C using the SSE4.2 crc32 instruction
+* @param data Bytes to checksum
+* @param size Number of bytes
+* @return checksum of the bytes
+*/
+__attribute__((target("sse4.2"))) static unsigned crc32c_hardware(const unsigned char* data, size_t size)
+{
+	unsigned crc = 0xFFFFFFFFu;
+	while (size >= sizeof(unsigned)) {
+		unsigned word;
+		memcpy(&word, data, sizeof(word));
+		crc = _mm_crc32_u32(crc, word);
+		data += sizeof(word);
+		size -= sizeof(word);
+	}
+	while (size--)
+		crc = _mm_crc32_u8(crc, *data++);
+	return ~crc;
+}
+#endif
+
+/**
+* CRC32C of a header, picks the instruction when the CPU has it
+* @param data Bytes to checksum
+* @param size Number of bytes
+* @return checksum of the bytes
+*/
+static unsigned crc32c(const unsigned char* data, size_t size)
+{
+#ifdef OA_HAS_CRC32_INSTRUCTION
+	static const bool hasInstruction = __builtin_cpu_supports("sse4.2");
+	if (hasInstruction)
+		return crc32c_hardware(data, size);
+#endif
+	return crc32c_software(data, size);
+}
+
 /**
 * @brief Constructor for ObjectAllocator class
 * @param ObjectSize size of the object to store
 * @param config Config file for the memory manager
 */
-ObjectAllocator::ObjectAllocator(size_t ObjectSize, const OAConfig & config) : PageList_(NULL), FreeList_(NULL), myConfig(config)
+ObjectAllocator::ObjectAllocator(size_t ObjectSize, const OAConfig & config) : PageList_(NULL), FreeList_(NULL), ZeroList_(NULL), myConfig(config),
+	dirtyTrackingReady(false), dirtyGeneration(0), autoSortInterval(0), freesSinceSort(0),
+	isFastPath(false), shadowThreshold(0), shadowSeed(static_cast<uint32_t>(reinterpret_cast<uintptr_t>(this) >> 4) | 1),
+	shadowBlockCount(0), shadowDeleteCount(0), isPageUseTracked(false), pageEpoch(0),
+	reservation(NULL), reservationSize(0), reservedBase(NULL), pageStride(0), reservedSlots(0), usedSlots(0),
+	isFreeDeferred(false), freeErrorCallback(NULL), reclaimedFrees(NULL), reclaimedCount(0),
+	queuedFreeCount(0), processedFreeCount(0), isWorkerStopping(false)
 {
 	// Save each object's size
 	myStats.ObjectSize_ = ObjectSize;
 
+	// The checksum sits right in front of the header, so it's part of the header section
+	headerChecksumSize = (myConfig.HeaderChecksum_ && myConfig.HBlockInfo_.type_ != OAConfig::hbNone) ? OAConfig::HEADER_CHECKSUM_SIZE : 0;
+	size_t headerSectionSize = myConfig.HBlockInfo_.size_ + headerChecksumSize;
+
 	// Calculate a page's total size
-	// Total Object Size
-	size_t totalObjectSizeInPage = myConfig.ObjectsPerPage_ * ObjectSize;
-	// Total Padding Size
-	size_t totalPaddingSizeInPage = myConfig.ObjectsPerPage_ * myConfig.PadBytes_ * 2; // Padding to the left and right
-	// Total HeaderSize
-	size_t totalHeaderSizeInPage = myConfig.HBlockInfo_.size_ * myConfig.ObjectsPerPage_; // One header per object
 	// Alignment
 	// For left alignment: One header, One pad-byte and one "Next" pointer
-	unsigned int leftTotalSize = static_cast<unsigned int>(myConfig.HBlockInfo_.size_ + myConfig.PadBytes_ + sizeof(void*));
-	myConfig.LeftAlignSize_ = myConfig.Alignment_ ? (leftTotalSize % myConfig.Alignment_) : 0;
+	unsigned int leftTotalSize = static_cast<unsigned int>(headerSectionSize + myConfig.PadBytes_ + sizeof(void*));
+	myConfig.LeftAlignSize_ = myConfig.Alignment_ ? (myConfig.Alignment_ - leftTotalSize % myConfig.Alignment_) % myConfig.Alignment_ : 0;
 	leftPageSectionSize = leftTotalSize + myConfig.LeftAlignSize_;
 	// For inter alignment = One header, two pad-bytes (after object and before next object) and object itself
-	unsigned int interTotalSize = static_cast<unsigned int>(myConfig.HBlockInfo_.size_ + myConfig.PadBytes_ * 2 + ObjectSize);
-	myConfig.InterAlignSize_ = myConfig.Alignment_ ? (interTotalSize % myConfig.Alignment_) : 0;
+	unsigned int interTotalSize = static_cast<unsigned int>(headerSectionSize + myConfig.PadBytes_ * 2 + ObjectSize);
+	myConfig.InterAlignSize_ = myConfig.Alignment_ ? (myConfig.Alignment_ - interTotalSize % myConfig.Alignment_) % myConfig.Alignment_ : 0;
 	interPageSectionSize = interTotalSize + myConfig.InterAlignSize_;
+
+	// A page is the left section, a block and its right pad, and an inter section for every other block
+	if (myConfig.PageBytes_) {
+		size_t firstBlockSize = leftPageSectionSize + ObjectSize + myConfig.PadBytes_;
+		if (myConfig.PageBytes_ < firstBlockSize)
+			throw OAException(OAException::E_NO_PAGES, "Page size is too small for one object");
+		myConfig.ObjectsPerPage_ = static_cast<unsigned>((myConfig.PageBytes_ - firstBlockSize) / interPageSectionSize + 1);
+	}
+
+	// Total Object Size
+	size_t totalObjectSizeInPage = myConfig.ObjectsPerPage_ * ObjectSize;
+	// Total Padding Size
+	size_t totalPaddingSizeInPage = myConfig.ObjectsPerPage_ * myConfig.PadBytes_ * 2; // Padding to the left and right
+	// Total HeaderSize
+	size_t totalHeaderSizeInPage = headerSectionSize * myConfig.ObjectsPerPage_; // One header per object
 	// total alignment size
 	size_t totalAlignmentSizeInPage = myConfig.LeftAlignSize_ + myConfig.InterAlignSize_ * (myConfig.ObjectsPerPage_ - 1);
 
 	// Save total size
 	myStats.PageSize_ = totalObjectSizeInPage + totalPaddingSizeInPage + totalHeaderSizeInPage + totalAlignmentSizeInPage + sizeof(void*);
+	myStats.PageWaste_ = myConfig.PageBytes_ ? myConfig.PageBytes_ - myStats.PageSize_ : 0;
+
+	if (myConfig.ReserveAddressSpace_ && !myConfig.UseCPPMemManager_)
+		reserve_address_space();
+
+	update_fast_path();
 
-	// Allocate the first page
-	allocate_new_page();
+	// Allocate the first page (new/delete doesn't use any)
+	try {
+		if (!myConfig.UseCPPMemManager_)
+			allocate_new_page();
+	}
+	catch (OAException &) {
+		release_address_space();
+		throw;
+	}
 }
 
 /**
@@ -59,9 +226,32 @@ ObjectAllocator::ObjectAllocator(size_t ObjectSize, const OAConfig & config) : P
 */
 ObjectAllocator::~ObjectAllocator()
 {
+	// Let the worker finish what's queued before the pages go away
+	if (isFreeDeferred)
+		SetDeferredFree(false);
+
+	// Blocks from new/delete that were never freed can't be found through this allocator anymore
+	for (std::unordered_set<void*>::iterator block = shadowBlocks.begin(); block != shadowBlocks.end(); ++block)
+		PageMap::Unregister(*block, myStats.ObjectSize_, this);
 
 	GenericObject* nextPage;
 
+	if (reservedBase) {
+		// Every page is found by its index, and one call gives the whole range back
+		for (size_t slot = 0; slot < usedSlots; ++slot) {
+			if (!isSlotCommitted[slot])
+				continue;
+			unsigned char* pageBegin = reservedBase + slot * pageStride;
+			if (myConfig.HBlockInfo_.type_ == OAConfig::HBLOCK_TYPE::hbExternal) {
+				for (unsigned i = 0; i < myConfig.ObjectsPerPage_; ++i)
+					free_external_header(pageBegin + leftPageSectionSize + i * interPageSectionSize - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_);
+			}
+			PageMap::Unregister(pageBegin, myStats.PageSize_, this);
+		}
+		PageList_ = NULL;
+		release_address_space();
+	}
+
 	while (PageList_) {
 		// If we have an external header and its not freed before, we're deleting all of them
 		if (myConfig.HBlockInfo_.type_ == OAConfig::HBLOCK_TYPE::hbExternal) {
@@ -74,40 +264,41 @@ ObjectAllocator::~ObjectAllocator()
 			}
 		}
 		nextPage = PageList_->Next;
-		delete[](reinterpret_cast<unsigned char*>(PageList_));
+		PageMap::Unregister(PageList_, myStats.PageSize_, this);
+		release_page_memory(reinterpret_cast<unsigned char*>(PageList_));
 		PageList_ = nextPage;
 	}
 }
 
 /**
-* @brief Allocate function for allocating memory block
+* @brief Allocate for everything the inline fast path doesn't handle
 * @param label The label of the memory block
 */
-void * ObjectAllocator::Allocate(const char * label)
+void * ObjectAllocator::allocate_slow(const char * label)
 {
 	if (myConfig.UseCPPMemManager_)
-	{
-		try {
-			void* allocatedObject = ::operator new(myStats.ObjectSize_);
-
-			// Bookkeeping
-			++myStats.Allocations_;
-			++myStats.ObjectsInUse_;
-			--myStats.FreeObjects_;
-			if (myStats.ObjectsInUse_ > myStats.MostObjects_) {
-				myStats.MostObjects_ = myStats.ObjectsInUse_;
-			}
-
-			return allocatedObject;
-		}
-		catch (std::bad_alloc& e) {
-			throw OAException(OAException::E_NO_MEMORY, "Cannot allocate new object - no physical memory left: " + std::string(e.what()));
-		}
-	}
+		return allocate_new_delete();
+	if (shadowThreshold)
+		return allocate_shadowed(label);
+	return allocate_block(label);
+}
 
+/**
+* Helper function to take a block from the pool
+* @param label The label of the memory block
+* @return the block
+*/
+void * ObjectAllocator::allocate_block(const char * label)
+{
 	// We everything is full, we need a new page
 	if (!FreeList_) {
-		allocate_new_page();
+		// Blocks the free worker is done with come first, then the zeroed ones
+		if (isFreeDeferred)
+			adopt_reclaimed_blocks();
+		if (!FreeList_ && ZeroList_)
+			take_zeroed_block();
+		if (!FreeList_)
+			allocate_new_page();
 	}
 
 	// Get the next free block
@@ -133,7 +324,7 @@ void * ObjectAllocator::Allocate(const char * label)
 		++counter;
 		memcpy(headerBlockIter, &counter, sizeof(counter));
 		headerBlockIter += sizeof(counter);
-		//DumpPages();
+		// fall through - the rest is the basic header
 	case OAConfig::HBLOCK_TYPE::hbBasic:
 		memcpy(headerBlockIter, &myStats.Allocations_, sizeof(unsigned));
 		headerBlockIter += sizeof(unsigned);
@@ -163,12 +354,20 @@ void * ObjectAllocator::Allocate(const char * label)
 		break;
 	}
 
+	if (headerChecksumSize)
+		write_header_checksum(reinterpret_cast<unsigned char*>(objectToBeReturned));
+
 	//DumpPages(32);
 
+	OA_UNPOISON(objectToBeReturned, myStats.ObjectSize_);
+
 	// set patterns if debug is on
 	if (myConfig.DebugOn_) {
 		memset(reinterpret_cast<unsigned char*>(objectToBeReturned), ALLOCATED_PATTERN, myStats.ObjectSize_);
 	}
+
+	if (isPageUseTracked)
+		touch_page(reinterpret_cast<unsigned char*>(objectToBeReturned), true);
 	
 	//DumpPages(32);
 
@@ -176,61 +375,386 @@ void * ObjectAllocator::Allocate(const char * label)
 }
 
 /**
-* Deallocation of a memory block
+* Allocate that waits for a free block when the pool is full
+* @param label The label of the memory block
+*/
+void * ObjectAllocator::AllocateWait(const char * label)
+{
+	return allocate_waiting(NULL, label);
+}
+
+/**
+* Allocate that waits up to a timeout for a free block when the pool is full
+* @param timeout How long to wait for another thread to free a block
+* @param label The label of the memory block
+*/
+void * ObjectAllocator::AllocateFor(std::chrono::milliseconds timeout, const char * label)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+	return allocate_waiting(&deadline, label);
+}
+
+/**
+* Allocate for a block whose bytes are all zero
+* @param label The label of the memory block
+*/
+void * ObjectAllocator::AllocateZeroed(const char * label)
+{
+	// Debug patterns would overwrite the zeros, so there's nothing to keep track of
+	if (!myConfig.UseCPPMemManager_ && !myConfig.DebugOn_) {
+		if (!ZeroList_ && !FreeList_) {
+			if (isFreeDeferred)
+				adopt_reclaimed_blocks();
+			if (!FreeList_)
+				allocate_zeroed_page();
+		}
+
+		if (ZeroList_) {
+			// Straight from the pool, Allocate could pick operator new in shadow mode
+			take_zeroed_block();
+			void* object = allocate_block(label);
+			// Only the link to the next block wasn't zero
+			memset(object, 0, sizeof(GenericObject*));
+			return object;
+		}
+	}
+
+	void* object = Allocate(label);
+	memset(object, 0, myStats.ObjectSize_);
+	return object;
+}
+
+/**
+* Zeroes free blocks ahead of time for AllocateZeroed
+* @param max most blocks to zero (0 for all of them)
+* @return blocks zeroed
+*/
+unsigned ObjectAllocator::ZeroFreeObjects(unsigned max)
+{
+	if (myConfig.UseCPPMemManager_ || myConfig.DebugOn_)
+		return 0;
+
+	unsigned counter = 0;
+	while (FreeList_ && (!max || counter < max)) {
+		GenericObject* block = FreeList_;
+		FreeList_ = block->Next;
+		unsigned char* body = reinterpret_cast<unsigned char*>(block) + sizeof(GenericObject*);
+		OA_UNPOISON(body, myStats.ObjectSize_ - sizeof(GenericObject*));
+		memset(body, 0, myStats.ObjectSize_ - sizeof(GenericObject*));
+		OA_POISON(body, myStats.ObjectSize_ - sizeof(GenericObject*));
+		block->Next = ZeroList_;
+		ZeroList_ = block;
+		++counter;
+	}
+	return counter;
+}
+
+/**
+* Puts the free blocks back in page and address order
+* @return number of free blocks
+*/
+unsigned ObjectAllocator::SortFreeList(void)
+{
+	freesSinceSort = 0;
+	if (myConfig.UseCPPMemManager_)
+		return 0;
+	return sort_list(&FreeList_) + sort_list(&ZeroList_);
+}
+
+/**
+* Turns automatic sorting of the free list on or off
+* @param frees Number of frees between sorts (0=off)
+*/
+void ObjectAllocator::SetAutoSortFreeList(unsigned frees)
+{
+	autoSortInterval = frees;
+	freesSinceSort = 0;
+	update_fast_path();
+}
+
+/**
+* Changes the maximum number of pages. Pages already in use above the new maximum
+* stay, but no page is added until enough of them are freed.
+* @param MaxPages maximum number of pages (0=unlimited)
+*/
+void ObjectAllocator::SetMaxPages(unsigned MaxPages)
+{
+	myConfig.MaxPages_ = MaxPages;
+}
+
+/**
+* Free for everything the inline fast path doesn't handle
 * @param Object object to be deallocated
 */
-void ObjectAllocator::Free(void * Object)
+void ObjectAllocator::free_slow(void * Object)
 {
 	if (myConfig.UseCPPMemManager_)
-	{
-		::operator delete(Object);
+		free_new_delete(Object);
+	else if (shadowThreshold || shadowBlockCount.load(std::memory_order_relaxed))
+		free_shadowed(Object);
+	else
+		free_block(Object);
+}
+
+/**
+* Helper function to give a block back to the pool
+* @param Object object to be deallocated
+*/
+void ObjectAllocator::free_block(void * Object)
+{
+	if (isFreeDeferred) {
+		// The worker does the rest, including the bookkeeping
+		while (!pendingFrees.TryPush(Object))
+			std::this_thread::yield();
+		queuedFreeCount.fetch_add(1);
+		workerSignal.notify_one();
+		return;
 	}
-	else {
-		unsigned char* memoryPointer = reinterpret_cast<unsigned char*>(Object);
-		if (myConfig.DebugOn_) {
 
-			// Check for double frees
-			check_double_free(memoryPointer);
-			// Check for corruption
-			check_corruption(memoryPointer);
-			// Check for Page boundaries
-			check_boundary(memoryPointer);
-			
-			memset(memoryPointer, FREED_PATTERN, myStats.ObjectSize_);
+	prepare_free(reinterpret_cast<unsigned char*>(Object), true);
+	put_on_freelist(Object);
+	if (isPageUseTracked)
+		touch_page(reinterpret_cast<unsigned char*>(Object), false);
+	if (autoSortInterval && ++freesSinceSort >= autoSortInterval)
+		SortFreeList();
 
+	++myStats.Deallocations_;
+	++myStats.FreeObjects_;
+	--myStats.ObjectsInUse_;
+}
+
+/**
+* Helper function to allocate a block with operator new. FreeObjects_ is left alone,
+* the block was never on the free list.
+* @return the block
+*/
+void * ObjectAllocator::allocate_new_delete(void)
+{
+	try {
+		void* allocatedObject = ::operator new(myStats.ObjectSize_);
+
+		// Bookkeeping
+		++myStats.Allocations_;
+		++myStats.ObjectsInUse_;
+		if (myStats.ObjectsInUse_ > myStats.MostObjects_) {
+			myStats.MostObjects_ = myStats.ObjectsInUse_;
 		}
 
-		unsigned char* headerBlockIter = memoryPointer - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_;
+		return allocatedObject;
+	}
+	catch (std::bad_alloc& e) {
+		throw OAException(OAException::E_NO_MEMORY, "Cannot allocate new object - no physical memory left: " + std::string(e.what()));
+	}
+}
 
-		switch (myConfig.HBlockInfo_.type_)
-		{
-		case OAConfig::HBLOCK_TYPE::hbExtended:
-			set_mem_and_move(&headerBlockIter, 0, myConfig.HBlockInfo_.additional_); //0 out user data
-			headerBlockIter += sizeof(unsigned short); //move past the use counter -> we don't change it
-		case OAConfig::HBLOCK_TYPE::hbBasic:
-			set_mem_and_move(&headerBlockIter, 0, sizeof(unsigned int)); //reset alloc number
-			set_mem_and_move(&headerBlockIter, 0, sizeof(char)); //toggle in-use
-			break;
-		case OAConfig::HBLOCK_TYPE::hbExternal:
-		{
-			free_external_header(headerBlockIter);
-			memset(headerBlockIter, 0, myConfig.HBlockInfo_.size_);
-			break;
+/**
+* Helper function to free a block from allocate_new_delete
+* @param Object object to be deallocated
+*/
+void ObjectAllocator::free_new_delete(void * Object)
+{
+	::operator delete(Object);
+	++myStats.Deallocations_;
+	--myStats.ObjectsInUse_;
+}
+
+/**
+* Helper function to count a block in the stats of a path
+* @param stats stats of the path
+* @param isAllocated whether the block was allocated or freed
+* @param nanoseconds time it took
+*/
+static void count_path(OAPathStats & stats, bool isAllocated, unsigned long long nanoseconds)
+{
+	if (isAllocated) {
+		++stats.Allocations_;
+		if (++stats.ObjectsInUse_ > stats.MostObjects_)
+			stats.MostObjects_ = stats.ObjectsInUse_;
+		stats.AllocateNanoseconds_ += nanoseconds;
+	}
+	else {
+		++stats.Deallocations_;
+		--stats.ObjectsInUse_;
+		stats.FreeNanoseconds_ += nanoseconds;
+	}
+}
+
+/**
+* Helper function to allocate in shadow mode, picks the path at random and times it
+* @param label The label of the memory block
+* @return the block
+*/
+void * ObjectAllocator::allocate_shadowed(const char * label)
+{
+	// xorshift32
+	shadowSeed ^= shadowSeed << 13;
+	shadowSeed ^= shadowSeed >> 17;
+	shadowSeed ^= shadowSeed << 5;
+	bool isNewDelete = (shadowSeed - 1) < shadowThreshold; // the seed is never 0
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	void* Object = isNewDelete ? allocate_new_delete() : allocate_block(label);
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
+
+	try {
+		if (isNewDelete)
+			PageMap::Register(Object, myStats.ObjectSize_, this);
+		std::lock_guard<std::mutex> lock(shadowLock);
+		if (isNewDelete)
+			shadowBlocks.insert(Object);
+		else
+			shadowPoolBlocks.insert(Object);
+		shadowBlockCount.store(shadowBlocks.size() + shadowPoolBlocks.size(), std::memory_order_relaxed);
+		count_path(isNewDelete ? shadowStats.NewDelete_ : shadowStats.Pool_, true,
+			static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+	}
+	catch (std::bad_alloc &) {
+		if (isNewDelete) {
+			PageMap::Unregister(Object, myStats.ObjectSize_, this);
+			free_new_delete(Object);
 		}
-		case OAConfig::HBLOCK_TYPE::hbNone:
-		default:
-			break;
+		else {
+			free_block(Object);
 		}
+		throw OAException(OAException::E_NO_MEMORY, "Cannot allocate new object - no physical memory left");
+	}
+	return Object;
+}
 
+/**
+* Helper function to free in shadow mode, sends the block back where it came from and times it
+* @param Object object to be deallocated
+*/
+void ObjectAllocator::free_shadowed(void * Object)
+{
+	bool isNewDelete;
+	bool isCounted;
+	{
+		std::lock_guard<std::mutex> lock(shadowLock);
+		isNewDelete = shadowBlocks.erase(Object) != 0;
+		// Pool blocks allocated while the mode was off (or by AllocateZeroed) weren't counted
+		isCounted = isNewDelete || shadowPoolBlocks.erase(Object) != 0;
+		shadowBlockCount.store(shadowBlocks.size() + shadowPoolBlocks.size(), std::memory_order_relaxed);
+	}
+	if (isNewDelete)
+		PageMap::Unregister(Object, myStats.ObjectSize_, this);
 
-		put_on_freelist(Object);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	if (!isNewDelete) {
+		free_block(Object);
+	}
+	else if (isFreeDeferred) {
+		// This may not be the owner's thread, the owner counts it in adopt_reclaimed_blocks
+		::operator delete(Object);
+		shadowDeleteCount.fetch_add(1);
+	}
+	else {
+		free_new_delete(Object);
+	}
+	std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - start;
 
+	if (isCounted) {
+		std::lock_guard<std::mutex> lock(shadowLock);
+		count_path(isNewDelete ? shadowStats.NewDelete_ : shadowStats.Pool_, false,
+			static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
 	}
+	// While frees are deferred the fast path is off anyway, and only the owner changes it
+	if (!shadowThreshold && !isFreeDeferred)
+		update_fast_path();
+}
 
-	++myStats.Deallocations_;
-	++myStats.FreeObjects_;
-	--myStats.ObjectsInUse_;
+/**
+* Turns shadow mode on, off or changes its split
+* @param NewDeleteFraction share of allocations that go to operator new (0=off)
+*/
+void ObjectAllocator::SetShadowMode(double NewDeleteFraction)
+{
+	if (myConfig.UseCPPMemManager_)
+		return;
+	if (NewDeleteFraction <= 0)
+		shadowThreshold = 0;
+	else if (NewDeleteFraction >= 1)
+		shadowThreshold = static_cast<uint64_t>(1) << 32;
+	else
+		shadowThreshold = static_cast<uint64_t>(NewDeleteFraction * 4294967296.0);
+	update_fast_path();
+}
+
+/**
+* Helper function to check whether Allocate/Free can skip allocate_slow/free_slow. Has to be
+* called whenever anything it looks at changes.
+*/
+void ObjectAllocator::update_fast_path(void)
+{
+#ifdef OA_NO_POISONING
+	bool isPoisoned = false;
+#else
+	bool isPoisoned = true;
+#endif
+	isFastPath = !myConfig.UseCPPMemManager_ && !myConfig.DebugOn_ && myConfig.HBlockInfo_.type_ == OAConfig::hbNone &&
+		!isPoisoned && !isFreeDeferred && !isPageUseTracked && !autoSortInterval &&
+		!shadowThreshold && !shadowBlockCount.load(std::memory_order_relaxed);
+}
+
+/**
+* Gets the stats of each path in shadow mode
+* @return stats of the pool and new/delete paths
+*/
+OAShadowStats ObjectAllocator::GetShadowStats(void) const
+{
+	std::lock_guard<std::mutex> lock(shadowLock);
+	return shadowStats;
+}
+
+/**
+* Turns deferred freeing on or off
+* @param State true=enable, false=disable
+* @param fn Callback for blocks that fail the debug checks (can be NULL)
+*/
+void ObjectAllocator::SetDeferredFree(bool State, FREEERRORCALLBACK fn)
+{
+	if (myConfig.UseCPPMemManager_)
+		return;
+
+	// The worker reads the callback while it runs. Turning the mode off keeps the old one
+	// until the queue has drained, so errors found on the way are still reported.
+	if (State || !isFreeDeferred)
+		freeErrorCallback.store(fn);
+	if (State == isFreeDeferred)
+		return;
+
+	if (State) {
+		isWorkerStopping = false;
+		isFreeDeferred = true;
+		update_fast_path();
+		freeWorker = std::thread(&ObjectAllocator::deferred_free_worker, this);
+	}
+	else {
+		{
+			std::lock_guard<std::mutex> lock(workerLock);
+			isWorkerStopping = true;
+		}
+		workerSignal.notify_one();
+		freeWorker.join();
+		freeErrorCallback.store(fn);
+		isFreeDeferred = false;
+		update_fast_path();
+		adopt_reclaimed_blocks();
+	}
+}
 
+/**
+* Waits for the worker to go through every queued block and takes the blocks back
+*/
+void ObjectAllocator::FlushDeferredFrees(void)
+{
+	if (isFreeDeferred) {
+		std::unique_lock<std::mutex> lock(workerLock);
+		size_t target = queuedFreeCount.load();
+		workerSignal.notify_one();
+		flushSignal.wait(lock, [this, target]() { return processedFreeCount >= target; });
+	}
+	adopt_reclaimed_blocks();
 }
 
 /**
@@ -268,7 +792,7 @@ unsigned ObjectAllocator::DumpMemoryInUse(DUMPCALLBACK fn) const
 */
 unsigned ObjectAllocator::ValidatePages(VALIDATECALLBACK fn) const
 {
-	if (!myConfig.DebugOn_ || myConfig.PadBytes_ == 0)
+	if (!myConfig.DebugOn_ || (myConfig.PadBytes_ == 0 && !headerChecksumSize))
 		return 0;
 
 
@@ -298,22 +822,244 @@ unsigned ObjectAllocator::ValidatePages(VALIDATECALLBACK fn) const
 	return counter;
 }
 
+/**
+* Goes through all the pages on multiple threads and checks for corruption for each memory block
+* @param fn Callback function for each corrupted block
+* @param threadCount Maximum number of threads to use (including the calling thread)
+* @return total amount of corrupted blocks
+*/
+unsigned ObjectAllocator::ValidatePages(VALIDATECALLBACK fn, unsigned threadCount) const
+{
+	if (!myConfig.DebugOn_ || (myConfig.PadBytes_ == 0 && !headerChecksumSize))
+		return 0;
+
+	// Snapshot the page list so each thread can get a contiguous range of it
+	std::vector<GenericObject*> pages;
+	pages.reserve(myStats.PagesInUse_);
+	for (GenericObject* pageListIterator = PageList_; pageListIterator; pageListIterator = pageListIterator->Next)
+		pages.push_back(pageListIterator);
+
+	if (threadCount > pages.size())
+		threadCount = static_cast<unsigned>(pages.size());
+	if (threadCount <= 1)
+		return ValidatePages(fn);
+
+	// Every thread writes into its own result list, so no locking is needed
+	std::vector<std::vector<unsigned char*> > corrupted(threadCount);
+	std::vector<std::thread> workers;
+	workers.reserve(threadCount - 1);
+
+	// Joins the threads already started if starting another one or checking the
+	// first range throws, a joinable std::thread would call std::terminate
+	struct Joiner
+	{
+		std::vector<std::thread>& threads;
+		~Joiner()
+		{
+			for (size_t i = 0; i < threads.size(); ++i)
+				if (threads[i].joinable())
+					threads[i].join();
+		}
+	} joiner = { workers };
+
+	size_t pagesPerThread = pages.size() / threadCount;
+	size_t remainder = pages.size() % threadCount;
+	size_t rangeBegin = 0;
+	size_t firstRangeSize = 0;
+	for (unsigned i = 0; i < threadCount; ++i) {
+		size_t rangeSize = pagesPerThread + (i < remainder ? 1 : 0);
+		if (i == 0) {
+			// The calling thread takes the first range itself
+			firstRangeSize = rangeSize;
+		}
+		else {
+			workers.push_back(std::thread(&ObjectAllocator::validate_pages, this, &pages[rangeBegin], rangeSize, &corrupted[i]));
+		}
+		rangeBegin += rangeSize;
+	}
+
+	validate_pages(&pages[0], firstRangeSize, &corrupted[0]);
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+
+	// Merge in page list order so callbacks are deterministic
+	unsigned counter = 0;
+	for (size_t i = 0; i < corrupted.size(); ++i) {
+		for (size_t j = 0; j < corrupted[i].size(); ++j) {
+			fn(corrupted[i][j], myStats.ObjectSize_);
+			++counter;
+		}
+	}
+
+	return counter;
+}
+
+/**
+* Checks for corruption only in the blocks that were written since the last call
+* @param fn Callback function for each corrupted block
+* @return total amount of corrupted blocks found in this pass
+*/
+unsigned ObjectAllocator::ValidateDirtyPages(VALIDATECALLBACK fn) const
+{
+	if (!myConfig.DebugOn_ || (myConfig.PadBytes_ == 0 && !headerChecksumSize))
+		return 0;
+
+#ifdef __linux__
+	std::lock_guard<std::mutex> lock(softDirtyLock);
+	if (!dirtyTrackingReady || dirtyGeneration != softDirtyGeneration) {
+		// No baseline yet, or another allocator cleared the bits and this one's writes since
+		// its last pass are lost, so everything has to be checked once
+		unsigned counter = ValidatePages(fn);
+		dirtyTrackingReady = clear_soft_dirty_bits();
+		return counter;
+	}
+
+	int pagemap = open("/proc/self/pagemap", O_RDONLY);
+	if (pagemap < 0) {
+		dirtyTrackingReady = false;
+		return ValidatePages(fn);
+	}
+
+	const uintptr_t osPageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	const uint64_t SOFT_DIRTY_BIT = static_cast<uint64_t>(1) << 55;
+	std::vector<uint64_t> entries;
+	unsigned counter = 0;
+
+	GenericObject* pageListIterator = PageList_;
+	while (pageListIterator) {
+		unsigned char* pageBegin = reinterpret_cast<unsigned char*>(pageListIterator);
+		// Read the pagemap entries of every OS page this page spans in one go
+		uintptr_t firstOSPage = reinterpret_cast<uintptr_t>(pageBegin) / osPageSize;
+		uintptr_t lastOSPage = (reinterpret_cast<uintptr_t>(pageBegin) + myStats.PageSize_ - 1) / osPageSize;
+		entries.resize(lastOSPage - firstOSPage + 1);
+		size_t bytesToRead = entries.size() * sizeof(uint64_t);
+		if (pread(pagemap, &entries[0], bytesToRead, static_cast<off_t>(firstOSPage * sizeof(uint64_t))) != static_cast<ssize_t>(bytesToRead)) {
+			// Can't tell what's dirty, treat everything as dirty
+			for (size_t i = 0; i < entries.size(); ++i)
+				entries[i] = SOFT_DIRTY_BIT;
+		}
+
+		unsigned char* pageIterator = pageBegin + leftPageSectionSize;
+		while (static_cast<unsigned int>(pageIterator - pageBegin) < myStats.PageSize_) {
+			// The padding on both sides of the block (and the header checksum) is what gets checked
+			uintptr_t blockFirst = (reinterpret_cast<uintptr_t>(pageIterator) - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_ - headerChecksumSize) / osPageSize;
+			uintptr_t blockLast = (reinterpret_cast<uintptr_t>(pageIterator) + myStats.ObjectSize_ + myConfig.PadBytes_ - 1) / osPageSize;
+			bool isDirty = false;
+			for (uintptr_t osPage = blockFirst; osPage <= blockLast && !isDirty; ++osPage)
+				isDirty = (entries[osPage - firstOSPage] & SOFT_DIRTY_BIT) != 0;
+
+			if (isDirty) {
+				try {
+					check_corruption(pageIterator);
+				}
+				catch (OAException &) {
+					fn(pageIterator, myStats.ObjectSize_);
+					++counter;
+				}
+			}
+			pageIterator += interPageSectionSize;
+		}
+		pageListIterator = pageListIterator->Next;
+	}
+
+	close(pagemap);
+	dirtyTrackingReady = clear_soft_dirty_bits();
+	return counter;
+#else
+	return ValidatePages(fn);
+#endif
+}
+
+/**
+* Marks a block as reachable so the next Sweep keeps it
+* @param Object block to be marked
+*/
+void ObjectAllocator::Mark(void * Object)
+{
+	if (myConfig.UseCPPMemManager_)
+		return;
+
+	unsigned char* memoryPointer = reinterpret_cast<unsigned char*>(Object);
+	check_boundary(memoryPointer);
+
+	size_t index;
+	std::vector<bool>& bits = find_block_bit(markBits, memoryPointer, &index);
+	bits[index] = true;
+}
+
+/**
+* Frees every block in use that wasn't marked
+* @param fn Finalizer called for each block before it's freed (can be NULL)
+* @return total amount of blocks freed
+*/
+unsigned ObjectAllocator::Sweep(FINALIZECALLBACK fn)
+{
+	if (myConfig.UseCPPMemManager_)
+		return 0;
+
+	// Queued blocks aren't on the free list yet and would look like unmarked live ones
+	FlushDeferredFrees();
+
+	// Find out what's free with a single walk of the free list instead of one walk per block
+	BlockBitmap freeBits;
+	size_t index;
+	GenericObject* lists[] = { FreeList_, ZeroList_ };
+	for (GenericObject* list : lists) {
+		for (GenericObject* freeIterator = list; freeIterator; freeIterator = freeIterator->Next) {
+			std::vector<bool>& bits = find_block_bit(freeBits, reinterpret_cast<unsigned char*>(freeIterator), &index);
+			bits[index] = true;
+		}
+	}
+
+	unsigned counter = 0;
+	GenericObject* pageListIterator = PageList_;
+	while (pageListIterator) {
+		unsigned char* pageBegin = reinterpret_cast<unsigned char*>(pageListIterator);
+		// Grab the next page first, the page itself is never touched by Free
+		pageListIterator = pageListIterator->Next;
+
+		BlockBitmap::iterator marked = markBits.find(pageBegin);
+		BlockBitmap::iterator freed = freeBits.find(pageBegin);
+		for (size_t i = 0; i < myConfig.ObjectsPerPage_; ++i) {
+			if ((marked != markBits.end() && marked->second[i]) || (freed != freeBits.end() && freed->second[i]))
+				continue;
+
+			unsigned char* block = pageBegin + leftPageSectionSize + i * interPageSectionSize;
+			if (fn)
+				fn(block, myStats.ObjectSize_);
+			Free(block);
+			++counter;
+		}
+	}
+
+	markBits.clear();
+	return counter;
+}
+
 /**
 * Frees all empty pages
 * @return pages removed
 */
 unsigned ObjectAllocator::FreeEmptyPages(void)
 {
+	FlushDeferredFrees();
+	std::lock_guard<std::mutex> lock(pageLock);
+
+	if (reservedBase)
+		return free_empty_reserved_pages();
+
 	GenericObject* prevPage = NULL;
 	GenericObject* currentPage = PageList_;
 	unsigned char * pageIterator;
 	unsigned char * pageBegin;
 	unsigned int counter = 0;
 
-	bool isPageEmpty = true;
+	bool isPageEmpty;
 	while (currentPage) {
 		pageBegin = reinterpret_cast<unsigned char*>(currentPage);
 		pageIterator = pageBegin + leftPageSectionSize;
+		isPageEmpty = true;
 
 		while (static_cast<unsigned int>(pageIterator - pageBegin) < myStats.PageSize_) {
 			if (!is_object_in_free_list(pageIterator)) {
@@ -330,6 +1076,7 @@ unsigned ObjectAllocator::FreeEmptyPages(void)
 			currentPage = currentPage->Next;
 			if(prevPage)
 				prevPage->Next = currentPage;
+			markBits.erase(reinterpret_cast<unsigned char*>(pageToDelete));
 			FreePage(pageToDelete);
 			isPageEmpty = true;
 			++counter;
@@ -345,6 +1092,113 @@ unsigned ObjectAllocator::FreeEmptyPages(void)
 	return counter;
 }
 
+/**
+* Checks whether an address is on one of the pages
+* @param Object address to be checked
+* @return whether the address belongs to this allocator
+*/
+bool ObjectAllocator::Owns(const void * Object) const
+{
+	const unsigned char* address = reinterpret_cast<const unsigned char*>(Object);
+	std::lock_guard<std::mutex> lock(pageLock);
+	return page_of(address) != NULL;
+}
+
+/**
+* Gets the fixed index of a block in the reserved range
+* @param Object block on a reserved page
+* @return page slot * ObjectsPerPage_ + place of the block on the page
+*/
+size_t ObjectAllocator::BlockIndex(const void * Object) const
+{
+	const unsigned char* address = reinterpret_cast<const unsigned char*>(Object);
+	const unsigned char* pageBegin = reservedBase ? reserved_page_of(address) : NULL;
+	if (!pageBegin || address < pageBegin + leftPageSectionSize)
+		throw OAException(OAException::E_BAD_ADDRESS, "Object given is not registered in any of the pages");
+	size_t blockDistance = static_cast<size_t>(address - pageBegin) - leftPageSectionSize;
+	if (blockDistance % interPageSectionSize != 0)
+		throw OAException(OAException::E_BAD_BOUNDARY, "Object given is not in correct boundary");
+	return static_cast<size_t>(pageBegin - reservedBase) / pageStride * myConfig.ObjectsPerPage_ + blockDistance / interPageSectionSize;
+}
+
+/**
+* Turns page use tracking on or off
+* @param State true=enable, false=disable
+*/
+void ObjectAllocator::SetPageUseTracking(bool State)
+{
+	pageUse.clear();
+	isPageUseTracked = State && !myConfig.UseCPPMemManager_;
+	update_fast_path();
+	if (!isPageUseTracked)
+		return;
+
+	// Everything starts out as touched now, with the live objects counted once
+	FlushDeferredFrees();
+	for (GenericObject* currentPage = PageList_; currentPage; currentPage = currentPage->Next) {
+		PageUse use = { pageEpoch, myConfig.ObjectsPerPage_, false };
+		pageUse[reinterpret_cast<unsigned char*>(currentPage)] = use;
+	}
+	GenericObject* lists[] = { FreeList_, ZeroList_ };
+	for (GenericObject* list : lists) {
+		for (GenericObject* freeIterator = list; freeIterator; freeIterator = freeIterator->Next) {
+			PageUseMap::iterator page = --pageUse.upper_bound(reinterpret_cast<unsigned char*>(freeIterator));
+			--page->second.liveObjects;
+		}
+	}
+}
+
+/**
+* Moves page use tracking to the next epoch
+*/
+void ObjectAllocator::Tick(void)
+{
+	++pageEpoch;
+}
+
+/**
+* Advises the kernel to reclaim pages that have live objects but weren't used for a while
+* @param idleTicks Epochs a page has to go untouched
+* @param pageOut true for MADV_PAGEOUT, false for MADV_COLD
+* @return pages advised
+*/
+unsigned ObjectAllocator::AdviseColdPages(unsigned idleTicks, bool pageOut)
+{
+#if defined(__linux__) && defined(MADV_COLD)
+	if (!isPageUseTracked)
+		return 0;
+
+	int advice = MADV_COLD;
+#ifdef MADV_PAGEOUT
+	if (pageOut)
+		advice = MADV_PAGEOUT;
+#endif
+	const uintptr_t osPageSize = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+	unsigned counter = 0;
+	for (PageUseMap::iterator page = pageUse.begin(); page != pageUse.end(); ++page) {
+		PageUse& use = page->second;
+		if (use.isAdvised || !use.liveObjects || pageEpoch - use.lastTouched < idleTicks)
+			continue;
+
+		// madvise only takes whole OS pages
+		uintptr_t begin = (reinterpret_cast<uintptr_t>(page->first) + osPageSize - 1) / osPageSize * osPageSize;
+		uintptr_t end = (reinterpret_cast<uintptr_t>(page->first) + myStats.PageSize_) / osPageSize * osPageSize;
+		if (begin >= end)
+			continue;
+
+		if (madvise(reinterpret_cast<void*>(begin), end - begin, advice) == 0) {
+			use.isAdvised = true;
+			++counter;
+		}
+	}
+	return counter;
+#else
+	(void)idleTicks;
+	(void)pageOut;
+	return 0;
+#endif
+}
+
 /**
 * Checks whether extra credit is implemented
 * @return is extra credit implemented or not
@@ -360,7 +1214,13 @@ bool ObjectAllocator::ImplementedExtraCredit(void)
 */
 void ObjectAllocator::SetDebugState(bool State)
 {
+	// The worker reads the debug state, and the debug checks read the pads and free blocks
+	if (State && !myConfig.DebugOn_) {
+		FlushDeferredFrees();
+		pattern_live_pages();
+	}
 	myConfig.DebugOn_ = State;
+	update_fast_path();
 }
 
 /**
@@ -396,53 +1256,251 @@ OAConfig ObjectAllocator::GetConfig(void) const
 */
 OAStats ObjectAllocator::GetStats(void) const
 {
-	return myStats;
+	OAStats stats = myStats;
+	// Blocks the free worker is done with count as freed even before they're back on the free list
+	unsigned reclaimed = reclaimedCount.load();
+	stats.Deallocations_ += reclaimed;
+	stats.FreeObjects_ += reclaimed;
+	stats.ObjectsInUse_ -= reclaimed;
+	// So do blocks from new/delete other threads freed in shadow mode
+	unsigned deleted = shadowDeleteCount.load();
+	stats.Deallocations_ += deleted;
+	stats.ObjectsInUse_ -= deleted;
+	return stats;
 }
 
 /**
 * Helper function to allocate a new page when a page is full
 */
 void ObjectAllocator::allocate_new_page(void)
+{
+	// Check if max. number of pages is reached before allocating anything
+	if (is_at_max_pages()) {
+		throw OAException(OAException::E_NO_PAGES, OUT_OF_LOGICAL_MEMORY_ERROR);
+	}
+
+	add_page(reservedBase ? commit_reserved_page() : new_page_memory());
+}
+
+/**
+* Helper function to check whether another page is allowed
+* @return whether max. number of pages is reached
+*/
+bool ObjectAllocator::is_at_max_pages(void) const
+{
+	return myConfig.MaxPages_ != 0 && myStats.PagesInUse_ >= myConfig.MaxPages_;
+}
+
+/**
+* Helper function to get the memory for a new page. Doesn't touch the lists,
+* so it can run outside of a lock that guards the allocator.
+* @return memory for one page
+*/
+unsigned char * ObjectAllocator::new_page_memory(void) const
 {
 	try {
-		// Check if max. number of pages is reached
-		if (myConfig.MaxPages_ != 0 && myStats.PagesInUse_ == myConfig.MaxPages_) {
-			throw OAException(OAException::E_NO_PAGES, OUT_OF_LOGICAL_MEMORY_ERROR);
+		unsigned char* newPage;
+		if (is_page_heap_used()) {
+			newPage = static_cast<unsigned char*>(PageHeap::Allocate(myStats.PageSize_));
+		}
+		else if (is_page_memory_aligned()) {
+			// Room to move the page up to the boundary, with the pointer for delete[] in front of it
+			unsigned char* memory = new unsigned char[myStats.PageSize_ + myConfig.Alignment_ - 1 + sizeof(void*)];
+			uintptr_t address = reinterpret_cast<uintptr_t>(memory + sizeof(void*));
+			newPage = memory + sizeof(void*) + (myConfig.Alignment_ - address % myConfig.Alignment_) % myConfig.Alignment_;
+			memcpy(newPage - sizeof(void*), &memory, sizeof(memory));
+		}
+		else {
+			newPage = new unsigned char[myStats.PageSize_];
 		}
-
-		// Allocate memory and increment pages currently allocated
-		unsigned char* newPage = new unsigned char[myStats.PageSize_];
 		// Set everything to UNALLOCATED_PATTERN
 		if(myConfig.DebugOn_)
 			memset(newPage, UNALLOCATED_PATTERN, myStats.PageSize_);
-		// Link pages
+		return newPage;
+	}
+	catch (std::bad_alloc & e) {
+		throw OAException(OAException::E_NO_MEMORY, OUT_OF_PHYSICAL_MEMORY_ERROR);
+	}
+}
+
+/**
+* Helper function to give back the memory of a page
+* @param page memory from new_page_memory or commit_reserved_page
+*/
+void ObjectAllocator::release_page_memory(unsigned char * page)
+{
+	OA_UNPOISON(page, myStats.PageSize_);
+	if (reservedBase) {
+		decommit_reserved_page(page);
+	}
+	else if (is_page_heap_used()) {
+		PageHeap::Free(page, myStats.PageSize_);
+	}
+	else if (is_page_memory_aligned()) {
+		unsigned char* memory;
+		memcpy(&memory, page - sizeof(void*), sizeof(memory));
+		delete[] memory;
+	}
+	else {
+		delete[] page;
+	}
+}
+
+/**
+* Helper function to check whether new[] alone can't give pages the requested alignment
+* @return whether pages are moved up to the alignment boundary
+*/
+bool ObjectAllocator::is_page_memory_aligned(void) const
+{
+	return myConfig.Alignment_ > alignof(std::max_align_t);
+}
+
+/**
+* Helper function to check whether pages come from the PageHeap. Its blocks are aligned
+* to PageHeap::MIN_BLOCK_SIZE, so bigger alignments and pages bigger than its largest
+* block still use new[].
+* @return whether new_page_memory uses the PageHeap
+*/
+bool ObjectAllocator::is_page_heap_used(void) const
+{
+	return myConfig.UsePageHeap_ && !reservedBase &&
+		myStats.PageSize_ <= PageHeap::MAX_BLOCK_SIZE && myConfig.Alignment_ <= PageHeap::MIN_BLOCK_SIZE;
+}
+
+/**
+* Helper function to link a new page and put its blocks on the free list
+* @param newPage memory from new_page_memory (released if max pages has been reached)
+*/
+void ObjectAllocator::add_page(unsigned char * newPage)
+{
+	if (is_at_max_pages()) {
+		release_page_memory(newPage);
+		throw OAException(OAException::E_NO_PAGES, OUT_OF_LOGICAL_MEMORY_ERROR);
+	}
+
+	// Link pages
+	{
+		std::lock_guard<std::mutex> lock(pageLock);
+		if (!reservedBase) {
+			try {
+				pageAddresses.insert(std::upper_bound(pageAddresses.begin(), pageAddresses.end(), newPage), newPage);
+			}
+			catch (std::bad_alloc &) {
+				release_page_memory(newPage);
+				throw OAException(OAException::E_NO_MEMORY, "Cannot allocate new page - out of physical memory");
+			}
+		}
 		GenericObject* oldPage = PageList_;
 		PageList_ = reinterpret_cast<GenericObject*>(newPage);
 		PageList_->Next = oldPage;
+	}
+
+	//DumpPages(32);
+
+	// Assign free list
+	initialize_page(PageList_);
+	PageMap::Register(PageList_, myStats.PageSize_, this);
+	if (isPageUseTracked) {
+		PageUse use = { pageEpoch, 0, false };
+		pageUse[newPage] = use;
+	}
+
+	// Bookkeeping
+	++myStats.PagesInUse_;
+	myStats.FreeObjects_ += myConfig.ObjectsPerPage_;
+}
+
+/**
+* Helper function to insert an object into the freelist
+* @param Object object to be inserted
+*/
+void ObjectAllocator::put_on_freelist(void * Object)
+{
+	GenericObject* nextObject = FreeList_;
+	FreeList_ = reinterpret_cast<GenericObject*>(Object);
+	FreeList_->Next = nextObject;
+}
 
-		//DumpPages(32);
+/**
+* Helper function to sort a list of free blocks by address: every block sets its bit in a
+* bitmap of the whole pool, then the list is rebuilt from the bitmap
+* @param list head of the list
+* @return number of blocks in the list
+*/
+unsigned ObjectAllocator::sort_list(GenericObject ** list)
+{
+	if (!*list)
+		return 0;
 
-		// Assign free list
-		initialize_page(PageList_);
+	// Pages in address order (in a reserved range that's the slot order already)
+	size_t pageCount = reservedBase ? usedSlots : pageAddresses.size();
 
+	sortBits.assign(pageCount * myConfig.ObjectsPerPage_, false);
+	unsigned counter = 0;
+	for (GenericObject* block = *list; block; block = block->Next) {
+		unsigned char* address = reinterpret_cast<unsigned char*>(block);
+		size_t page;
+		unsigned char* pageBegin;
+		if (reservedBase) {
+			page = static_cast<size_t>(address - reservedBase) / pageStride;
+			pageBegin = reservedBase + page * pageStride;
+		}
+		else {
+			page = static_cast<size_t>(std::upper_bound(pageAddresses.begin(), pageAddresses.end(), address) - pageAddresses.begin()) - 1;
+			pageBegin = pageAddresses[page];
+		}
+		sortBits[page * myConfig.ObjectsPerPage_ + static_cast<size_t>(address - pageBegin - leftPageSectionSize) / interPageSectionSize] = true;
+		++counter;
 	}
-	catch (std::bad_alloc & e) {
-		throw OAException(OAException::E_NO_MEMORY, OUT_OF_PHYSICAL_MEMORY_ERROR);
+
+	// Link from the last block to the first, so the list starts at the lowest address
+	GenericObject* head = NULL;
+	for (size_t i = sortBits.size(); i-- > 0;) {
+		if (!sortBits[i])
+			continue;
+		size_t page = i / myConfig.ObjectsPerPage_;
+		unsigned char* pageBegin = reservedBase ? reservedBase + page * pageStride : pageAddresses[page];
+		GenericObject* block = reinterpret_cast<GenericObject*>(pageBegin + leftPageSectionSize + (i % myConfig.ObjectsPerPage_) * interPageSectionSize);
+		block->Next = head;
+		head = block;
 	}
-	// Bookkeeping
-	++myStats.PagesInUse_;
-	myStats.FreeObjects_ += myConfig.ObjectsPerPage_;
+	*list = head;
+	return counter;
 }
 
 /**
-* Helper function to insert an object into the freelist
-* @param Object object to be inserted
+* Helper function to move a zeroed block to the front of the free list
 */
-void ObjectAllocator::put_on_freelist(void * Object)
+void ObjectAllocator::take_zeroed_block(void)
 {
-	GenericObject* nextObject = FreeList_;
-	FreeList_ = reinterpret_cast<GenericObject*>(Object);
-	FreeList_->Next = nextObject;
+	GenericObject* block = ZeroList_;
+	ZeroList_ = block->Next;
+	block->Next = FreeList_;
+	FreeList_ = block;
+}
+
+/**
+* Helper function to add a page whose blocks all go on the zeroed list,
+* called when the free list is empty
+*/
+void ObjectAllocator::allocate_zeroed_page(void)
+{
+	if (is_at_max_pages()) {
+		throw OAException(OAException::E_NO_PAGES, OUT_OF_LOGICAL_MEMORY_ERROR);
+	}
+
+	// One memset for the whole page instead of one per block (a freshly committed page is zero already)
+	unsigned char* newPage;
+	if (reservedBase) {
+		newPage = commit_reserved_page();
+	}
+	else {
+		newPage = new_page_memory();
+		memset(newPage, 0, myStats.PageSize_);
+	}
+	add_page(newPage);
+	ZeroList_ = FreeList_;
+	FreeList_ = NULL;
 }
 
 /**
@@ -490,10 +1548,77 @@ void ObjectAllocator::initialize_page(GenericObject* pageListBegin)
 	if (myConfig.DebugOn_)
 		set_mem_and_move(&(pageIterator += myStats.ObjectSize_), PAD_PATTERN, myConfig.PadBytes_);
 
+	// Clear the headers (an external one is a pointer that gets deleted) and give every
+	// header a valid checksum so free blocks can be validated too
+	if (headerChecksumSize || (!myConfig.DebugOn_ && myConfig.HBlockInfo_.size_)) {
+		unsigned char* blockIterator = pageBegin + leftPageSectionSize;
+		while (static_cast<unsigned int>(blockIterator - pageBegin) < myStats.PageSize_) {
+			if (!myConfig.DebugOn_) // Debug mode already cleared the headers
+				memset(blockIterator - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_, 0, myConfig.HBlockInfo_.size_);
+			if (headerChecksumSize)
+				write_header_checksum(blockIterator);
+			blockIterator += interPageSectionSize;
+		}
+	}
+
+	if (!myConfig.DebugOn_)
+		poison_page(pageBegin);
+
 	//DumpPages(32);
 
 }
 
+/**
+* Helper function to poison everything on a new page but the page link, the headers and
+* the free list links (only does something when built with OA_POISON_MEMORY)
+* @param pageBegin beginning of the page
+*/
+void ObjectAllocator::poison_page(unsigned char * pageBegin)
+{
+#ifdef OA_POISON_MEMORY
+	OA_POISON(pageBegin + sizeof(void*), myStats.PageSize_ - sizeof(void*));
+	size_t headerSectionSize = myConfig.HBlockInfo_.size_ + headerChecksumSize;
+	unsigned char* blockIterator = pageBegin + leftPageSectionSize;
+	while (static_cast<unsigned int>(blockIterator - pageBegin) < myStats.PageSize_) {
+		OA_UNPOISON(blockIterator - myConfig.PadBytes_ - headerSectionSize, headerSectionSize);
+		OA_UNPOISON(blockIterator, sizeof(GenericObject*));
+		blockIterator += interPageSectionSize;
+	}
+#else
+	(void)pageBegin;
+#endif
+}
+
+/**
+* Helper function for SetDebugState, gives the pages made without debug the patterns the
+* debug checks expect: pads and alignment on every block, the freed pattern in free blocks
+* (behind the link). Zeroed blocks aren't kept in debug mode, so they go back on the free list.
+*/
+void ObjectAllocator::pattern_live_pages(void)
+{
+	while (ZeroList_)
+		take_zeroed_block();
+
+	for (GenericObject* currentPage = PageList_; currentPage; currentPage = currentPage->Next) {
+		unsigned char* pageBegin = reinterpret_cast<unsigned char*>(currentPage);
+		OA_UNPOISON(pageBegin, myStats.PageSize_);
+		memset(pageBegin + sizeof(void*), ALIGN_PATTERN, myConfig.LeftAlignSize_);
+		unsigned char* blockIterator = pageBegin + leftPageSectionSize;
+		while (static_cast<unsigned int>(blockIterator - pageBegin) < myStats.PageSize_) {
+			memset(blockIterator - myConfig.PadBytes_, PAD_PATTERN, myConfig.PadBytes_);
+			memset(blockIterator + myStats.ObjectSize_, PAD_PATTERN, myConfig.PadBytes_);
+			blockIterator += interPageSectionSize;
+			if (static_cast<unsigned int>(blockIterator - pageBegin) < myStats.PageSize_)
+				memset(blockIterator - interPageSectionSize + myStats.ObjectSize_ + myConfig.PadBytes_, ALIGN_PATTERN, myConfig.InterAlignSize_);
+		}
+	}
+
+	for (GenericObject* block = FreeList_; block; block = block->Next) {
+		if (myStats.ObjectSize_ > sizeof(GenericObject*))
+			memset(reinterpret_cast<unsigned char*>(block) + sizeof(GenericObject*), FREED_PATTERN, myStats.ObjectSize_ - sizeof(GenericObject*));
+	}
+}
+
 /**
 * Helper function to set a memory block with a value and advance pointer by size
 * @param begin Pointer to the memory block pointer
@@ -515,8 +1640,8 @@ void ObjectAllocator::set_non_data_block_pattern(unsigned char ** begin, size_t
 {
 	// Left alignment
 	set_mem_and_move(begin, ALIGN_PATTERN, alignSize);
-	// Left header
-	set_mem_and_move(begin, 0, myConfig.HBlockInfo_.size_);
+	// Left header (and its checksum)
+	set_mem_and_move(begin, 0, headerChecksumSize + myConfig.HBlockInfo_.size_);
 	// Left padding
 	set_mem_and_move(begin, PAD_PATTERN, myConfig.PadBytes_);
 
@@ -553,14 +1678,16 @@ bool ObjectAllocator::is_object_in_free_list(void * Object) const
 		MemBlockInfo** blockInfoP = reinterpret_cast<MemBlockInfo**>(blockIter);
 		MemBlockInfo* blockInfo = *blockInfoP;
 		if(blockInfo)
-			return blockInfo->in_use;
+			return !blockInfo->in_use;
 	}
 
-	GenericObject* currentObjectInFreeList = FreeList_;
-	while (currentObjectInFreeList) {
-		if (currentObjectInFreeList == Object)
-			return true;
-		currentObjectInFreeList = currentObjectInFreeList->Next;
+	GenericObject* lists[] = { FreeList_, ZeroList_ };
+	for (GenericObject* currentObjectInFreeList : lists) {
+		while (currentObjectInFreeList) {
+			if (currentObjectInFreeList == Object)
+				return true;
+			currentObjectInFreeList = currentObjectInFreeList->Next;
+		}
 	}
 	return false;
 }
@@ -580,25 +1707,277 @@ void ObjectAllocator::free_external_header(unsigned char * object)
 	delete blockInfo;
 }
 
+/**
+* Helper function to collect the corrupted blocks of a range of pages
+* @param pages First page of the range
+* @param pageCount Number of pages in the range
+* @param corrupted List to append the corrupted blocks to
+*/
+void ObjectAllocator::validate_pages(GenericObject* const* pages, size_t pageCount, std::vector<unsigned char*>* corrupted) const
+{
+	for (size_t i = 0; i < pageCount; ++i) {
+		unsigned char* pageBegin = reinterpret_cast<unsigned char*>(pages[i]);
+		unsigned char* pageIterator = pageBegin + leftPageSectionSize;
+
+		while (static_cast<unsigned int>(pageIterator - pageBegin) < myStats.PageSize_) {
+			try {
+				check_corruption(pageIterator);
+			}
+			catch (OAException &) {
+				corrupted->push_back(pageIterator);
+			}
+			pageIterator += interPageSectionSize;
+		}
+	}
+}
+
+/**
+* Helper function to reset the soft-dirty bits of every page in the process, softDirtyLock
+* has to be held
+* @return whether the bits could be reset
+*/
+bool ObjectAllocator::clear_soft_dirty_bits(void) const
+{
+#ifdef __linux__
+	// Kernels built without CONFIG_MEM_SOFT_DIRTY accept the write below but never set the bit.
+	// A page that was just written is always soft-dirty when tracking works, so probe one once.
+	static const bool isSupported = []() {
+		const size_t osPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+		std::vector<unsigned char> probe(osPageSize * 2);
+		uintptr_t probePage = (reinterpret_cast<uintptr_t>(&probe[0]) + osPageSize - 1) / osPageSize;
+		*reinterpret_cast<volatile unsigned char*>(probePage * osPageSize) = 1;
+
+		int pagemap = open("/proc/self/pagemap", O_RDONLY);
+		if (pagemap < 0)
+			return false;
+		uint64_t entry = 0;
+		bool hasBit = pread(pagemap, &entry, sizeof(entry), static_cast<off_t>(probePage * sizeof(uint64_t))) == sizeof(entry)
+			&& (entry & (static_cast<uint64_t>(1) << 55)) != 0;
+		close(pagemap);
+		return hasBit;
+	}();
+	if (!isSupported)
+		return false;
+
+	int clearRefs = open("/proc/self/clear_refs", O_WRONLY);
+	if (clearRefs < 0)
+		return false;
+	// "4" only clears the soft-dirty bits, the rest of the page state is left alone
+	bool isCleared = write(clearRefs, "4", 1) == 1;
+	close(clearRefs);
+	dirtyGeneration = ++softDirtyGeneration;
+	return isCleared;
+#else
+	return false;
+#endif
+}
+
+/**
+* Helper function to find the bit of a block in a per-page bitmap, adding the page if needed
+* @param bitmap Bitmap to search
+* @param Object block on one of the pages
+* @param index Set to the index of the block in its page
+* @return bits of the page the block is on
+*/
+std::vector<bool>& ObjectAllocator::find_block_bit(BlockBitmap& bitmap, unsigned char * Object, size_t* index) const
+{
+	unsigned char* pageBegin = page_of(Object);
+	*index = static_cast<size_t>(Object - (pageBegin + leftPageSectionSize)) / interPageSectionSize;
+	std::vector<bool>& bits = bitmap[pageBegin];
+	if (bits.empty())
+		bits.resize(myConfig.ObjectsPerPage_);
+	return bits;
+}
+
+/**
+* Helper function to record an Allocate or Free on the page of a block
+* @param Object block that was allocated or freed
+* @param isAllocated true for Allocate, false for Free
+*/
+void ObjectAllocator::touch_page(unsigned char * Object, bool isAllocated)
+{
+	PageUseMap::iterator page = --pageUse.upper_bound(Object);
+	page->second.lastTouched = pageEpoch;
+	page->second.isAdvised = false;
+	if (isAllocated)
+		++page->second.liveObjects;
+	else
+		--page->second.liveObjects;
+}
+
+/**
+* Helper function to run the checks on a block being freed and reset it, without putting it on the free list
+* @param memoryPointer block being freed
+* @param canWalkFreeList whether FreeList_ can be used for the double free check (not on the worker thread)
+*/
+void ObjectAllocator::prepare_free(unsigned char * memoryPointer, bool canWalkFreeList)
+{
+	// In debug mode this is part of the corruption check below
+	if (headerChecksumSize && !myConfig.DebugOn_)
+		check_header_checksum(memoryPointer);
+
+	if (myConfig.DebugOn_) {
+
+		// Check for Page boundaries first, the other checks read the block and its padding
+		check_boundary(memoryPointer);
+		// Check for double frees (the worker can't walk the free list, so blocks too small
+		// to hold the freed pattern after the link are only checked when freed synchronously)
+		if (canWalkFreeList || myStats.ObjectSize_ > sizeof(void*))
+			check_double_free(memoryPointer);
+		// Check for corruption
+		check_corruption(memoryPointer);
+		
+		memset(memoryPointer, FREED_PATTERN, myStats.ObjectSize_);
+
+	}
+
+	unsigned char* headerBlockIter = memoryPointer - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_;
+
+	switch (myConfig.HBlockInfo_.type_)
+	{
+	case OAConfig::HBLOCK_TYPE::hbExtended:
+		set_mem_and_move(&headerBlockIter, 0, myConfig.HBlockInfo_.additional_); //0 out user data
+		headerBlockIter += sizeof(unsigned short); //move past the use counter -> we don't change it
+		// fall through - the rest is the basic header
+	case OAConfig::HBLOCK_TYPE::hbBasic:
+		set_mem_and_move(&headerBlockIter, 0, sizeof(unsigned int)); //reset alloc number
+		set_mem_and_move(&headerBlockIter, 0, sizeof(char)); //toggle in-use
+		break;
+	case OAConfig::HBLOCK_TYPE::hbExternal:
+	{
+		free_external_header(headerBlockIter);
+		memset(headerBlockIter, 0, myConfig.HBlockInfo_.size_);
+		break;
+	}
+	case OAConfig::HBLOCK_TYPE::hbNone:
+	default:
+		break;
+	}
+
+	if (headerChecksumSize)
+		write_header_checksum(memoryPointer);
+
+	// The link to the next free block is written by the caller
+	if (!myConfig.DebugOn_ && myStats.ObjectSize_ > sizeof(GenericObject*))
+		OA_POISON(memoryPointer + sizeof(GenericObject*), myStats.ObjectSize_ - sizeof(GenericObject*));
+}
+
+/**
+* Background thread for deferred freeing: drains the queue and hands the blocks back
+*/
+void ObjectAllocator::deferred_free_worker(void)
+{
+	std::unique_lock<std::mutex> lock(workerLock);
+	for (;;) {
+		// Free doesn't take the lock before notifying, so poll now and then in case a wakeup was missed
+		workerSignal.wait_for(lock, std::chrono::milliseconds(1), [this]() { return isWorkerStopping || !pendingFrees.IsEmpty(); });
+		bool isStopping = isWorkerStopping;
+		lock.unlock();
+
+		size_t processed = 0;
+		while (void* Object = pendingFrees.TryPop()) {
+			try {
+				prepare_free(reinterpret_cast<unsigned char*>(Object), false);
+
+				// Count first so the count is never behind the list
+				reclaimedCount.fetch_add(1);
+				GenericObject* block = reinterpret_cast<GenericObject*>(Object);
+				block->Next = reclaimedFrees.load(std::memory_order_relaxed);
+				while (!reclaimedFrees.compare_exchange_weak(block->Next, block, std::memory_order_release, std::memory_order_relaxed))
+					;
+			}
+			catch (OAException & e) {
+				FREEERRORCALLBACK callback = freeErrorCallback.load();
+				if (callback)
+					callback(Object, e);
+			}
+			++processed;
+		}
+
+		lock.lock();
+		processedFreeCount += processed;
+		flushSignal.notify_all();
+		if (isStopping && pendingFrees.IsEmpty())
+			break;
+	}
+}
+
+/**
+* Helper function for the waiting versions of Allocate
+* @param deadline When to give up (NULL=never)
+* @param label The label of the memory block
+*/
+void * ObjectAllocator::allocate_waiting(const std::chrono::steady_clock::time_point* deadline, const char * label)
+{
+	for (;;) {
+		try {
+			return Allocate(label);
+		}
+		catch (OAException & e) {
+			// Only the free worker can give blocks back while we wait
+			if (e.code() != OAException::E_NO_PAGES || !isFreeDeferred)
+				throw;
+
+			std::unique_lock<std::mutex> lock(workerLock);
+			auto hasReclaimed = [this]() { return reclaimedFrees.load() != NULL; };
+			if (!deadline)
+				flushSignal.wait(lock, hasReclaimed);
+			else if (!flushSignal.wait_until(lock, *deadline, hasReclaimed))
+				throw;
+		}
+	}
+}
+
+/**
+* Helper function to move the blocks the worker is done with onto the free list
+*/
+void ObjectAllocator::adopt_reclaimed_blocks(void)
+{
+	// Blocks from new/delete freed by other threads in shadow mode
+	unsigned deleted = shadowDeleteCount.exchange(0);
+	myStats.Deallocations_ += deleted;
+	myStats.ObjectsInUse_ -= deleted;
+
+	GenericObject* reclaimed = reclaimedFrees.exchange(NULL, std::memory_order_acquire);
+	if (!reclaimed)
+		return;
+
+	unsigned counter = 1;
+	GenericObject* tail = reclaimed;
+	if (isPageUseTracked)
+		touch_page(reinterpret_cast<unsigned char*>(tail), false);
+	while (tail->Next) {
+		tail = tail->Next;
+		++counter;
+		if (isPageUseTracked)
+			touch_page(reinterpret_cast<unsigned char*>(tail), false);
+	}
+	tail->Next = FreeList_;
+	FreeList_ = reclaimed;
+	reclaimedCount.fetch_sub(counter);
+
+	// Bookkeeping
+	myStats.Deallocations_ += counter;
+	myStats.FreeObjects_ += counter;
+	myStats.ObjectsInUse_ -= counter;
+}
+
 /**
 * Helper function to check boundaries of an object
 * @param Object object to be checked
 */
 void ObjectAllocator::check_boundary(unsigned char * Object) const
 {
-	GenericObject* currentPage = PageList_;
-	unsigned char* currentPageBegin;
+	// The free worker calls this while the owner may be adding pages
+	std::lock_guard<std::mutex> lock(pageLock);
 	// Find the page this memory belongs to
-	while (currentPage) { // Check all pages and see if this object is in between my pages
-		currentPageBegin = reinterpret_cast<unsigned char*>(currentPage);
-		if (Object > currentPageBegin && Object < (currentPageBegin + myStats.PageSize_)) {
-			break;
-		}
-		currentPage = currentPage->Next;
+	unsigned char* currentPageBegin = page_of(Object);
+	if (currentPageBegin == Object) { // The page link isn't a block
+		if (reservedBase)
+			throw OAException(OAException::E_BAD_BOUNDARY, "Object given is not in correct boundary");
+		currentPageBegin = NULL;
 	}
-	// After loop execution:
-	// if (currentPage) currentPage = the page mem block is in and currentPageBegin = char* of it
-	if (currentPage) {
+	if (currentPageBegin) {
 		unsigned char* firstBlock = currentPageBegin + leftPageSectionSize;
 		size_t blockDistance = Object - firstBlock;
 		if (blockDistance % interPageSectionSize != 0) { // If total distance cannot be divided into block sizes
@@ -639,6 +2018,9 @@ void ObjectAllocator::check_double_free(unsigned char * Object) const
 */
 void ObjectAllocator::check_corruption(unsigned char * Object) const
 {
+	if (headerChecksumSize)
+		check_header_checksum(Object);
+
 	if (myConfig.PadBytes_ == 0)
 		return;
 
@@ -654,23 +2036,227 @@ void ObjectAllocator::check_corruption(unsigned char * Object) const
 		}
 	}
 
-	// Point to the end of tail padding block
-	paddingIterator = objectEnd + myConfig.PadBytes_ - 1;
-	while (paddingIterator != objectEnd) {
-		if(*(paddingIterator--) != PAD_PATTERN)
+	// Iterate through the tail padding block the same way
+	paddingIterator = objectEnd;
+	while (paddingIterator != objectEnd + myConfig.PadBytes_) {
+		if(*(paddingIterator++) != PAD_PATTERN)
 			throw OAException(OAException::E_CORRUPTED_BLOCK, "Tail padding for this block doesn't match the pattern.");
 	}
 }
 
 /**
-* Helper function to free a page from the page list
-* @param pageHead head pointer of a page
+* Helper function to check whether the header of an object still matches its checksum
+* @param Object object to be checked
 */
-void ObjectAllocator::FreePage(GenericObject * pageHead)
+void ObjectAllocator::check_header_checksum(unsigned char * Object) const
+{
+	unsigned char* header = Object - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_;
+	unsigned storedChecksum;
+	memcpy(&storedChecksum, header - headerChecksumSize, sizeof(storedChecksum));
+	if (storedChecksum != crc32c(header, myConfig.HBlockInfo_.size_))
+		throw OAException(OAException::E_CORRUPTED_BLOCK, "Header for this block doesn't match its checksum.");
+}
+
+/**
+* Helper function to store the checksum of an object's header in front of it
+* @param Object object whose header changed
+*/
+void ObjectAllocator::write_header_checksum(unsigned char * Object)
+{
+	unsigned char* header = Object - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_;
+	unsigned checksum = crc32c(header, myConfig.HBlockInfo_.size_);
+	memcpy(header - headerChecksumSize, &checksum, sizeof(checksum));
+}
+
+/**
+* Helper function to get the size of an OS page
+* @return size of an OS page in bytes
+*/
+static size_t os_page_size(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+}
+
+/**
+* Helper function to reserve address space for every page the allocator may need, without memory behind it
+*/
+void ObjectAllocator::reserve_address_space(void)
+{
+	size_t osPageSize = os_page_size();
+	size_t granularity = myConfig.Alignment_ > osPageSize ? myConfig.Alignment_ : osPageSize;
+	pageStride = (myStats.PageSize_ + granularity - 1) / granularity * granularity;
+	reservedSlots = myConfig.MaxPages_ ? myConfig.MaxPages_ : DEFAULT_RESERVED_BYTES / pageStride;
+	if (!reservedSlots || reservedSlots > (static_cast<size_t>(-1) - granularity) / pageStride)
+		throw OAException(OAException::E_NO_MEMORY, "Cannot reserve address space - the pages don't fit");
+	reservationSize = reservedSlots * pageStride + (granularity - osPageSize);
+
+#ifdef _WIN32
+	void* range = VirtualAlloc(NULL, reservationSize, MEM_RESERVE, PAGE_NOACCESS);
+	if (!range)
+		throw OAException(OAException::E_NO_MEMORY, "Cannot reserve address space - VirtualAlloc failed");
+#else
+	void* range = mmap(NULL, reservationSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (range == MAP_FAILED)
+		throw OAException(OAException::E_NO_MEMORY, "Cannot reserve address space - mmap failed");
+#endif
+	reservation = static_cast<unsigned char*>(range);
+	uintptr_t address = reinterpret_cast<uintptr_t>(reservation);
+	reservedBase = reservation + (granularity - address % granularity) % granularity;
+	usedSlots = 0;
+	isSlotCommitted.assign(reservedSlots, false);
+}
+
+/**
+* Helper function to give the reserved address space back (committed pages included)
+*/
+void ObjectAllocator::release_address_space(void)
+{
+	if (!reservation)
+		return;
+#ifdef _WIN32
+	VirtualFree(reservation, 0, MEM_RELEASE);
+#else
+	munmap(reservation, reservationSize);
+#endif
+	reservation = NULL;
+	reservedBase = NULL;
+}
+
+/**
+* Helper function to put memory behind the next free slot of the reserved range
+* @return the new page
+*/
+unsigned char * ObjectAllocator::commit_reserved_page(void)
+{
+	size_t slot;
+	if (!freeSlots.empty())
+		slot = freeSlots.back();
+	else if (usedSlots < reservedSlots)
+		slot = usedSlots;
+	else
+		throw OAException(OAException::E_NO_MEMORY, "Cannot allocate new page - reserved address space is used up");
+
+	unsigned char* newPage = reservedBase + slot * pageStride;
+#ifdef _WIN32
+	bool isCommitted = VirtualAlloc(newPage, pageStride, MEM_COMMIT, PAGE_READWRITE) != NULL;
+#else
+	bool isCommitted = mprotect(newPage, pageStride, PROT_READ | PROT_WRITE) == 0;
+#endif
+	if (!isCommitted)
+		throw OAException(OAException::E_NO_MEMORY, "Cannot allocate new page - the OS can't commit memory");
+
+	if (!freeSlots.empty())
+		freeSlots.pop_back();
+	else
+		++usedSlots;
+	isSlotCommitted[slot] = true;
+
+	// Set everything to UNALLOCATED_PATTERN
+	if (myConfig.DebugOn_)
+		memset(newPage, UNALLOCATED_PATTERN, myStats.PageSize_);
+	return newPage;
+}
+
+/**
+* Helper function to take the memory away from a page of the reserved range, keeping the address space
+* @param page page from commit_reserved_page
+*/
+void ObjectAllocator::decommit_reserved_page(unsigned char * page)
+{
+	size_t slot = static_cast<size_t>(page - reservedBase) / pageStride;
+#ifdef _WIN32
+	VirtualFree(page, pageStride, MEM_DECOMMIT);
+#else
+	// Drop the contents so the slot is zero when it's committed again
+	madvise(page, pageStride, MADV_DONTNEED);
+	mprotect(page, pageStride, PROT_NONE);
+#endif
+	isSlotCommitted[slot] = false;
+	freeSlots.push_back(slot);
+}
+
+/**
+* Helper function to find the page of an address in the reserved range
+* @param address address to look up
+* @return beginning of the committed page the address is on, NULL if there's none
+*/
+unsigned char * ObjectAllocator::reserved_page_of(const unsigned char * address) const
+{
+	if (address < reservedBase || address >= reservedBase + usedSlots * pageStride)
+		return NULL;
+	size_t offset = static_cast<size_t>(address - reservedBase);
+	size_t slot = offset / pageStride;
+	if (!isSlotCommitted[slot] || offset % pageStride >= myStats.PageSize_)
+		return NULL;
+	return reservedBase + slot * pageStride;
+}
+
+/**
+* Helper function to find the page an address is on, by binary search over the pages in
+* address order (or by index in a reserved range)
+* @param address address to look up
+* @return start of the page, NULL if the address is on none of this allocator's pages
+*/
+unsigned char * ObjectAllocator::page_of(const unsigned char * address) const
+{
+	if (reservedBase)
+		return reserved_page_of(address);
+	std::vector<unsigned char*>::const_iterator page = std::upper_bound(pageAddresses.begin(), pageAddresses.end(), address);
+	if (page == pageAddresses.begin() || address >= *--page + myStats.PageSize_)
+		return NULL;
+	return *page;
+}
+
+/**
+* Helper function for FreeEmptyPages in a reserved range: pages are visited by index and
+* the page list is relinked afterwards instead of being walked
+* @return pages removed
+*/
+unsigned ObjectAllocator::free_empty_reserved_pages(void)
+{
+	unsigned counter = 0;
+	for (size_t slot = 0; slot < usedSlots; ++slot) {
+		if (!isSlotCommitted[slot])
+			continue;
+		unsigned char* pageBegin = reservedBase + slot * pageStride;
+		bool isPageEmpty = true;
+		for (unsigned i = 0; i < myConfig.ObjectsPerPage_ && isPageEmpty; ++i)
+			isPageEmpty = is_object_in_free_list(pageBegin + leftPageSectionSize + i * interPageSectionSize);
+		if (!isPageEmpty)
+			continue;
+
+		markBits.erase(pageBegin);
+		FreePage(reinterpret_cast<GenericObject*>(pageBegin));
+		++counter;
+	}
+
+	// Newest pages first, like add_page links them
+	PageList_ = NULL;
+	for (size_t slot = 0; slot < usedSlots; ++slot) {
+		if (!isSlotCommitted[slot])
+			continue;
+		GenericObject* page = reinterpret_cast<GenericObject*>(reservedBase + slot * pageStride);
+		page->Next = PageList_;
+		PageList_ = page;
+	}
+	return counter;
+}
+
+/**
+* Helper function to take the blocks of a page off a list of free blocks
+* @param list head of the list
+* @param pageBegin beginning of the page
+*/
+void ObjectAllocator::remove_page_blocks(GenericObject ** list, unsigned char * pageBegin)
 {
-	unsigned char * pageBegin = reinterpret_cast<unsigned char*>(pageHead);
 	unsigned char * pageIterator;
-	GenericObject* currentBlock = FreeList_;
+	GenericObject* currentBlock = *list;
 	GenericObject* prevBlock = NULL;
 	GenericObject* blockToDelete;
 	bool isDeleted = false;
@@ -680,7 +2266,7 @@ void ObjectAllocator::FreePage(GenericObject * pageHead)
 			blockToDelete = reinterpret_cast<GenericObject*>(pageIterator);
 			if (blockToDelete == currentBlock) {
 				if(myConfig.HBlockInfo_.type_ == OAConfig::HBLOCK_TYPE::hbExternal)
-					free_external_header(pageIterator);
+					free_external_header(pageIterator - myConfig.PadBytes_ - myConfig.HBlockInfo_.size_);
 				isDeleted = true;
 				break;
 			}
@@ -689,8 +2275,8 @@ void ObjectAllocator::FreePage(GenericObject * pageHead)
 		}
 
 		if (isDeleted) {
-			if (currentBlock == FreeList_)
-				FreeList_ = currentBlock->Next;
+			if (currentBlock == *list)
+				*list = currentBlock->Next;
 			currentBlock = currentBlock->Next;
 			if(prevBlock)
 				prevBlock->Next = currentBlock;
@@ -702,7 +2288,111 @@ void ObjectAllocator::FreePage(GenericObject * pageHead)
 		}
 
 	}
+}
+
+/**
+* Helper function to free a page from the page list
+* @param pageHead head pointer of a page
+*/
+void ObjectAllocator::FreePage(GenericObject * pageHead)
+{
+	unsigned char * pageBegin = reinterpret_cast<unsigned char*>(pageHead);
+	remove_page_blocks(&FreeList_, pageBegin);
+	remove_page_blocks(&ZeroList_, pageBegin);
+	pageUse.erase(pageBegin);
+
+	// Bookkeeping
+	--myStats.PagesInUse_;
+	myStats.FreeObjects_ -= myConfig.ObjectsPerPage_;
+
+	// The caller holds pageLock
+	if (!reservedBase)
+		pageAddresses.erase(std::lower_bound(pageAddresses.begin(), pageAddresses.end(), pageBegin));
+
+	PageMap::Unregister(pageHead, myStats.PageSize_, this);
+	release_page_memory(reinterpret_cast<unsigned char*>(pageHead));
+
+}
+
+/**
+* @brief Constructor for FreeQueue class, every cell starts out free
+*/
+FreeQueue::FreeQueue(void) : head(0), tail(0)
+{
+	for (size_t i = 0; i < CAPACITY; ++i) {
+		cells[i].sequence.store(i, std::memory_order_relaxed);
+		cells[i].object = NULL;
+	}
+}
+
+/**
+* Adds a block to the queue, safe to call from any thread
+* @param Object block to be queued
+* @return false if the queue is full
+*/
+bool FreeQueue::TryPush(void * Object)
+{
+	size_t position = tail.load(std::memory_order_relaxed);
+	Cell* cell;
+	for (;;) {
+		cell = &cells[position & (CAPACITY - 1)];
+		size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		ptrdiff_t difference = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position);
+		if (difference == 0) {
+			// Cell is free, try to claim it
+			if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				break;
+		}
+		else if (difference < 0) {
+			// Cell still holds a block from the previous lap
+			return false;
+		}
+		else {
+			position = tail.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->object = Object;
+	cell->sequence.store(position + 1, std::memory_order_release);
+	return true;
+}
+
+/**
+* Takes the oldest block off the queue, only the consuming thread may call this
+* @return the block or NULL if the queue is empty
+*/
+void * FreeQueue::TryPop(void)
+{
+	size_t position = head.load(std::memory_order_relaxed);
+	Cell& cell = cells[position & (CAPACITY - 1)];
+	if (cell.sequence.load(std::memory_order_acquire) != position + 1)
+		return NULL;
+
+	void* Object = cell.object;
+	head.store(position + 1, std::memory_order_relaxed);
+	// Hand the cell over to the push that is one lap ahead
+	cell.sequence.store(position + CAPACITY, std::memory_order_release);
+	return Object;
+}
 
-	delete[](reinterpret_cast<unsigned char*>(pageHead));
+/**
+* Checks whether there's anything to pop
+* @return whether the queue is empty
+*/
+bool FreeQueue::IsEmpty(void) const
+{
+	size_t position = head.load(std::memory_order_relaxed);
+	return cells[position & (CAPACITY - 1)].sequence.load(std::memory_order_acquire) != position + 1;
+}
 
+/**
+* Frees a block through whichever allocator owns it
+* @param Object block to be freed
+*/
+void oa::Free(void * Object)
+{
+	ObjectAllocator* owner = PageMap::Find(Object);
+	if (!owner)
+		throw OAException(OAException::E_BAD_ADDRESS, "Object given is not registered in any allocator");
+	owner->Free(Object);
 }
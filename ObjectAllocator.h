@@ -4,7 +4,29 @@
 //---------------------------------------------------------------------------
 
 #include <cstring>
+#include <cstdint>
 #include <iostream>
+#include <vector>
+#include <map>
+#include <unordered_set>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+// Allocate/Free are inlined into the callers for the common case, everything else is
+// kept out of line so it doesn't bloat them
+#if defined(__GNUC__)
+#define OA_NOINLINE __attribute__((noinline))
+#define OA_LIKELY(condition) __builtin_expect(!!(condition), 1)
+#elif defined(_MSC_VER)
+#define OA_NOINLINE __declspec(noinline)
+#define OA_LIKELY(condition) (condition)
+#else
+#define OA_NOINLINE
+#define OA_LIKELY(condition) (condition)
+#endif
 
 // If the client doesn't specify these:
 static const int DEFAULT_OBJECTS_PER_PAGE = 4;
@@ -21,7 +43,7 @@ public:
 		E_BAD_BOUNDARY,   // block address is on a page, but not on any block-boundary
 		E_BAD_ADDRESS,	  // address is not on a page
 		E_MULTIPLE_FREE,  // block has already been freed
-		E_CORRUPTED_BLOCK,// block has been corrupted (pad bytes have been overwritten)
+		E_CORRUPTED_BLOCK,// block has been corrupted (pad bytes or header checksum don't match)
 		E_NO_OBJECTS	  // max object is reached TODO:LOOKATTHIS
 	};
 
@@ -47,6 +69,7 @@ struct OAConfig
 {
 	static const size_t BASIC_HEADER_SIZE = sizeof(unsigned) + 1; // allocation number + flags
 	static const size_t EXTERNAL_HEADER_SIZE = sizeof(void*);     // just a pointer
+	static const size_t HEADER_CHECKSUM_SIZE = sizeof(unsigned);  // CRC32C of the header
 
 	enum HBLOCK_TYPE { hbNone, hbBasic, hbExtended, hbExternal };
 	struct HeaderBlockInfo
@@ -71,13 +94,21 @@ struct OAConfig
 		bool DebugOn = false,
 		unsigned PadBytes = 0,
 		const HeaderBlockInfo &HBInfo = HeaderBlockInfo(),
-		unsigned Alignment = 0) : UseCPPMemManager_(UseCPPMemManager),
+		unsigned Alignment = 0,
+		bool HeaderChecksum = false,
+		bool ReserveAddressSpace = false,
+		bool UsePageHeap = false,
+		size_t PageBytes = 0) : UseCPPMemManager_(UseCPPMemManager),
 		ObjectsPerPage_(ObjectsPerPage),
 		MaxPages_(MaxPages),
 		DebugOn_(DebugOn),
 		PadBytes_(PadBytes),
 		HBlockInfo_(HBInfo),
-		Alignment_(Alignment)
+		Alignment_(Alignment),
+		HeaderChecksum_(HeaderChecksum),
+		ReserveAddressSpace_(ReserveAddressSpace),
+		UsePageHeap_(UsePageHeap),
+		PageBytes_(PageBytes)
 	{
 		HBlockInfo_ = HBInfo;
 		LeftAlignSize_ = 0;
@@ -91,6 +122,12 @@ struct OAConfig
 	unsigned PadBytes_;          // size of the left/right padding for each block
 	HeaderBlockInfo HBlockInfo_; // size of the header for each block (0=no headers)
 	unsigned Alignment_;      // address alignment of each block
+	bool HeaderChecksum_;     // keep a CRC32C of each header in front of it (ignored without headers)
+	bool ReserveAddressSpace_; // reserve room for MaxPages_ pages up front and commit them one by one
+	bool UsePageHeap_;        // take pages from the process-wide PageHeap, shared with other allocators
+	size_t PageBytes_;        // target page size (e.g. 4 KiB, 64 KiB, 2 MiB), ObjectsPerPage_ becomes as many
+	                          // blocks as fit in it (0=use ObjectsPerPage_). The page is exactly one OS page or
+	                          // PageHeap block with ReserveAddressSpace_ or UsePageHeap_, new[] adds its own header.
 
 	unsigned LeftAlignSize_;  // number of alignment bytes required to align first block
 	unsigned InterAlignSize_; // number of alignment bytes required between remaining blocks
@@ -100,7 +137,7 @@ struct OAConfig
 struct OAStats
 {
 	OAStats(void) : ObjectSize_(0), PageSize_(0), FreeObjects_(0), ObjectsInUse_(0), PagesInUse_(0),
-		MostObjects_(0), Allocations_(0), Deallocations_(0) {};
+		MostObjects_(0), Allocations_(0), Deallocations_(0), PageWaste_(0) {};
 
 	size_t ObjectSize_;      // size of each object
 	size_t PageSize_;        // size of a page including all headers, padding, etc.
@@ -110,6 +147,27 @@ struct OAStats
 	unsigned MostObjects_;   // most objects in use by client at one time
 	unsigned Allocations_;   // total requests to allocate memory
 	unsigned Deallocations_; // total requests to free memory
+	size_t PageWaste_;       // bytes of OAConfig::PageBytes_ left over after the last block of a page
+};
+
+// Stats of one path in shadow mode (ObjectAllocator::SetShadowMode)
+struct OAPathStats
+{
+	OAPathStats(void) : Allocations_(0), Deallocations_(0), ObjectsInUse_(0), MostObjects_(0),
+		AllocateNanoseconds_(0), FreeNanoseconds_(0) {};
+
+	unsigned Allocations_;     // blocks handed out by this path
+	unsigned Deallocations_;   // blocks given back to this path
+	unsigned ObjectsInUse_;    // blocks of this path the client holds
+	unsigned MostObjects_;     // most blocks of this path in use at one time
+	unsigned long long AllocateNanoseconds_; // total time spent allocating on this path
+	unsigned long long FreeNanoseconds_;     // total time spent freeing on this path
+};
+
+struct OAShadowStats
+{
+	OAPathStats Pool_;      // blocks from the pages
+	OAPathStats NewDelete_; // blocks from operator new
 };
 
 // This allows us to easily treat raw objects as nodes in a linked list
@@ -125,6 +183,35 @@ struct MemBlockInfo
 	unsigned alloc_num; // The allocation number (count) of this block
 };
 
+// Bounded lock-free queue of blocks waiting to be freed by the background thread.
+// Any number of threads can push, only the background thread pops. The blocks
+// themselves aren't used for links, so pushing the same block twice is harmless.
+class FreeQueue
+{
+public:
+	static const size_t CAPACITY = 1024; // must be a power of 2
+
+	FreeQueue(void);
+
+	bool TryPush(void *Object); // false if the queue is full
+	void *TryPop(void);         // NULL if the queue is empty
+	bool IsEmpty(void) const;
+
+private:
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		void *object;
+	};
+
+	Cell cells[CAPACITY];
+	std::atomic<size_t> head; // next cell to pop
+	std::atomic<size_t> tail; // next cell to push
+
+	FreeQueue(const FreeQueue &);
+	FreeQueue &operator=(const FreeQueue &);
+};
+
 // This memory manager class 
 class ObjectAllocator
 {
@@ -132,6 +219,8 @@ public:
 	// Defined by the client (pointer to a block, size of block)
 	typedef void(*DUMPCALLBACK)(const void *, size_t);
 	typedef void(*VALIDATECALLBACK)(const void *, size_t);
+	typedef void(*FINALIZECALLBACK)(void *, size_t);
+	typedef void(*FREEERRORCALLBACK)(const void *, const OAException &);
 
 	// Predefined values for memory signatures
 	static const unsigned char UNALLOCATED_PATTERN = 0xAA;
@@ -149,21 +238,119 @@ public:
 
 	// Take an object from the free list and give it to the client (simulates new)
 	// Throws an exception if the object can't be allocated. (Memory allocation problem)
+	// Inline while the free list has blocks and there's nothing to do but pop one:
+	// no debugging, headers, shadow mode, page use tracking, deferred or sorted frees.
 	void *Allocate(const char *label = 0);
 
+	// Same as Allocate, but when max pages has been reached it waits for another thread to
+	// free a block instead of throwing. Only deferred freeing (SetDeferredFree) lets other
+	// threads free blocks, without it these throw right away like Allocate. A pool shared
+	// between threads should use SynchronizedObjectAllocator's, which wake up on its Free.
+	// AllocateFor throws E_NO_PAGES if nothing was freed within the timeout.
+	void *AllocateWait(const char *label = 0);
+	void *AllocateFor(std::chrono::milliseconds timeout, const char *label = 0);
+
+	// Same as Allocate, but every byte of the block is zero. Blocks of a page added for
+	// it and blocks zeroed by ZeroFreeObjects don't need a memset (except for the free
+	// list link), other blocks are cleared on the spot.
+	void *AllocateZeroed(const char *label = 0);
+
+	// Zeroes up to max free blocks (0 for all) ahead of AllocateZeroed, so it can be done
+	// in batches when the program has time. Doesn't do anything while debugging.
+	unsigned ZeroFreeObjects(unsigned max = 0);
+
+	// Relinks the free blocks in page and address order, so the next Allocates hand out
+	// neighbouring blocks again. Takes time proportional to the size of the pool.
+	// Returns the number of free blocks.
+	unsigned SortFreeList(void);
+
+	// Calls SortFreeList after every frees calls to Free (0 turns it off)
+	void SetAutoSortFreeList(unsigned frees);
+
+	// Changes OAConfig::MaxPages_ of a running allocator. In reserved address space mode
+	// the pool still can't grow past the range reserved at construction.
+	void SetMaxPages(unsigned MaxPages);
+
 	// Returns an object to the free list for the client (simulates delete)
 	// Throws an exception if the the object can't be freed. (Invalid object)
+	// Inline under the same conditions as Allocate.
 	void Free(void *Object);
 
+	// Turns deferred freeing on or off. While it's on, Free only queues the block (and can
+	// be called from any thread); a background thread runs the debug checks, fills the
+	// pattern and hands the block back. Errors are reported through fn instead of thrown.
+	// Calling it again while it's on changes fn. Turning it off waits for the queue to
+	// drain, errors found on the way still go to the old fn.
+	void SetDeferredFree(bool State, FREEERRORCALLBACK fn = 0);
+
+	// Waits until every queued Free has been processed and puts the blocks on the free list.
+	// Call before DumpMemoryInUse/ValidatePages/FreeEmptyPages for exact results.
+	void FlushDeferredFrees(void);
+
 	// Calls the callback fn for each block still in use
 	unsigned DumpMemoryInUse(DUMPCALLBACK fn) const;
 
 	// Calls the callback fn for each block that is potentially corrupted
 	unsigned ValidatePages(VALIDATECALLBACK fn) const;
 
+	// Same as above, but splits the pages across up to threadCount threads.
+	// Callbacks are still made on the calling thread, in page list order.
+	unsigned ValidatePages(VALIDATECALLBACK fn, unsigned threadCount) const;
+
+	// Incremental version of ValidatePages. The first call checks every block, later
+	// calls only check blocks whose padding sits on OS pages written since the last call.
+	// Uses the Linux soft-dirty bits, which are process-wide: when another allocator has
+	// cleared them since this one's last call, the call checks every block again. Other
+	// writers of /proc/self/clear_refs in the process can't be noticed and hide the writes
+	// before them. Falls back to a full ValidatePages where soft-dirty tracking is unavailable.
+	unsigned ValidateDirtyPages(VALIDATECALLBACK fn) const;
+
+	// Marks a block in use as reachable for the next Sweep
+	// Throws an exception if the object is not a block of this allocator. (Invalid object)
+	void Mark(void *Object);
+
+	// Frees every block in use that wasn't marked since the last Sweep, calling fn
+	// (if given) on each one first. Clears all marks. Returns the number of blocks freed.
+	// Waits for deferred frees first (FlushDeferredFrees).
+	unsigned Sweep(FINALIZECALLBACK fn = 0);
+
 	// Frees all empty pages (extra credit)
 	unsigned FreeEmptyPages(void);
 
+	// Returns true if Object is on one of this allocator's pages
+	bool Owns(const void *Object) const;
+
+	// With OAConfig::ReserveAddressSpace_ every block has a fixed index: the place of its
+	// page in the reserved range times ObjectsPerPage_ plus its place on the page.
+	// BlockIndex throws an exception if Object isn't a block on a reserved page. (Invalid object)
+	// BlockAt is the way back, it doesn't check anything.
+	size_t BlockIndex(const void *Object) const;
+	void *BlockAt(size_t Index) const;
+
+	// Turns page use tracking on or off. While it's on, every page remembers the epoch it
+	// was last touched in by Allocate or Free and how many live objects it holds. Tick moves
+	// to the next epoch, call it on a timer; idle times are counted in ticks.
+	void SetPageUseTracking(bool State);
+	void Tick(void);
+
+	// Tells the kernel that pages with live objects that weren't touched for idleTicks can
+	// be reclaimed first (MADV_COLD), or right away with pageOut (MADV_PAGEOUT). The objects
+	// stay where they are and are read back when used. Only whole OS pages inside a page are
+	// advised, and a page is advised once until it's touched again. Empty pages are left
+	// for FreeEmptyPages. Returns the number of pages advised (0 without madvise).
+	unsigned AdviseColdPages(unsigned idleTicks, bool pageOut = false);
+
+	// Shadow mode, for comparing the pool with new/delete on real traffic. Each Allocate
+	// goes to operator new with a chance of NewDeleteFraction (0 turns it off), the rest
+	// come from the pool as usual, debug checks included. Free sends every block back
+	// where it came from. GetStats covers both paths (FreeObjects_ only the pool), and
+	// GetShadowStats has the counts and time spent of each path while the mode is on.
+	// Only blocks Allocate handed out in shadow mode are counted there, AllocateZeroed
+	// takes zeroed blocks from the pool without picking a path. Blocks from new/delete
+	// are in the PageMap too, so oa::Free finds them.
+	void SetShadowMode(double NewDeleteFraction);
+	OAShadowStats GetShadowStats(void) const;
+
 	// Returns true if FreeEmptyPages and alignments are implemented
 	static bool ImplementedExtraCredit(void);
 
@@ -178,8 +365,17 @@ private:
 	// Some "suggested" members (only a suggestion!)
 	GenericObject *PageList_;           // the beginning of the list of pages
 	GenericObject *FreeList_;           // the beginning of the list of objects
+	GenericObject *ZeroList_;           // free objects known to be zero (but for the link)
 	void allocate_new_page(void);       // allocates another page of objects
+	bool is_at_max_pages(void) const;
+	unsigned char* new_page_memory(void) const; // memory for one page, doesn't touch the lists
+	void add_page(unsigned char* newPage);      // links and initializes a page from new_page_memory
+	void release_page_memory(unsigned char* page);       // gives back memory from new_page_memory/commit_reserved_page
+	bool is_page_memory_aligned(void) const;    // whether pages have to be moved up to Alignment_
+	bool is_page_heap_used(void) const;         // whether pages come from the PageHeap
 	void put_on_freelist(void *Object); // puts Object onto the free list
+	void take_zeroed_block(void);       // moves the first zeroed block to the free list
+	void allocate_zeroed_page(void);    // allocates another page of zeroed objects
 
 	// Extended - Egemen
 	OAConfig myConfig;
@@ -189,26 +385,171 @@ private:
 	unsigned int leftPageSectionSize;
 	unsigned int interPageSectionSize;
 	unsigned int rightPageSectionSize;
+	size_t headerChecksumSize; // bytes in front of each header for its checksum (0=disabled)
 
 	// My helper functions
 	void initialize_page(GenericObject* pageBegin);
+	void poison_page(unsigned char* pageBegin);
+	void pattern_live_pages(void);
 	void set_mem_and_move(unsigned char** begin, int value, size_t size);
 	void set_non_data_block_pattern(unsigned char** begin, size_t alignSize);
 	void move_freelist(unsigned char* position);
 	bool is_object_in_free_list(void* Object) const;
 	void free_external_header(unsigned char* object);
+	void validate_pages(GenericObject* const* pages, size_t pageCount, std::vector<unsigned char*>* corrupted) const;
+
+	// Soft-dirty tracking for ValidateDirtyPages
+	mutable bool dirtyTrackingReady; // soft-dirty bits were cleared after the last full pass
+	mutable unsigned long dirtyGeneration; // number of process-wide clears after this allocator's last one
+	bool clear_soft_dirty_bits(void) const;
+
+	// Every page in address order (pages in a reserved range are found by index instead),
+	// changed under pageLock. page_of looks up the page of an address in it.
+	std::vector<unsigned char*> pageAddresses;
+	unsigned char* page_of(const unsigned char* address) const; // NULL if not on a page
+
+	// Mark bits for Mark/Sweep, one bit per block, keyed by page
+	typedef std::map<unsigned char*, std::vector<bool> > BlockBitmap;
+	BlockBitmap markBits;
+	std::vector<bool>& find_block_bit(BlockBitmap& bitmap, unsigned char* Object, size_t* index) const;
+
+	// Free list sorting
+	unsigned autoSortInterval;              // Frees between automatic sorts (0=never)
+	unsigned freesSinceSort;
+	std::vector<bool> sortBits;             // reused by sort_list
+	unsigned sort_list(GenericObject** list);
+
+	// Whether Allocate/Free only have to pop/push the free list and count
+	bool isFastPath;
+	void update_fast_path(void);
+	OA_NOINLINE void *allocate_slow(const char *label);
+	OA_NOINLINE void free_slow(void *Object);
+
+	// Shadow mode
+	uint64_t shadowThreshold;                  // random numbers under it pick new/delete, 0=off
+	uint32_t shadowSeed;                       // xorshift state
+	std::unordered_set<void*> shadowBlocks;    // blocks in use from new/delete, in the PageMap for oa::Free
+	std::unordered_set<void*> shadowPoolBlocks; // pool blocks counted in shadowStats.Pool_
+	OAShadowStats shadowStats;
+	mutable std::mutex shadowLock;             // guards the sets and shadowStats, deferred Free can come from any thread
+	std::atomic<size_t> shadowBlockCount;      // blocks in both sets
+	std::atomic<unsigned> shadowDeleteCount;   // new/delete blocks freed while deferred, not in myStats yet
+	void *allocate_block(const char *label);   // Allocate from the pool
+	void free_block(void *Object);             // Free to the pool
+	void *allocate_new_delete(void);           // Allocate with operator new (UseCPPMemManager_ and shadow mode)
+	void free_new_delete(void *Object);
+	void *allocate_shadowed(const char *label);
+	void free_shadowed(void *Object);
+
+	// Page use tracking for AdviseColdPages
+	struct PageUse
+	{
+		unsigned lastTouched; // epoch of the last Allocate/Free on the page
+		unsigned liveObjects; // objects in use on the page
+		bool isAdvised;       // madvise was called since the last touch
+	};
+	typedef std::map<unsigned char*, PageUse> PageUseMap;
+	bool isPageUseTracked;
+	unsigned pageEpoch;
+	PageUseMap pageUse;
+	void touch_page(unsigned char* Object, bool isAllocated);
+
+	// Reserved address space (OAConfig::ReserveAddressSpace_). Page i lives at
+	// reservedBase + i * pageStride, so finding a page is arithmetic instead of a list walk.
+	unsigned char* reservation;        // what the OS returned (NULL when pages come from new[])
+	size_t reservationSize;
+	unsigned char* reservedBase;       // first page, aligned to Alignment_
+	size_t pageStride;                 // page size rounded up to whole OS pages
+	size_t reservedSlots;              // pages that fit in the range
+	size_t usedSlots;                  // slots committed at least once, they're used in order
+	std::vector<size_t> freeSlots;     // slots decommitted by FreeEmptyPages, used again first
+	std::vector<bool> isSlotCommitted;
+	void reserve_address_space(void);
+	void release_address_space(void);
+	unsigned char* commit_reserved_page(void);
+	void decommit_reserved_page(unsigned char* page);
+	unsigned char* reserved_page_of(const unsigned char* address) const; // NULL if not on a committed page
+	unsigned free_empty_reserved_pages(void);
 
 	// Free debug checks
 	void check_boundary(unsigned char* Object) const;
 	void check_double_free(unsigned char* Object) const;
 	void check_corruption(unsigned char* Object) const;
+	void check_header_checksum(unsigned char* Object) const;
+	void write_header_checksum(unsigned char* Object);
 
 	// Extra credit
 	void FreePage(GenericObject* pageHead);
+	void remove_page_blocks(GenericObject** list, unsigned char* pageBegin);
+
+	// Deferred freeing
+	void prepare_free(unsigned char* Object, bool canWalkFreeList); // checks, patterns and resets the header of a block being freed
+	void deferred_free_worker(void);
+	void adopt_reclaimed_blocks(void);
+	void *allocate_waiting(const std::chrono::steady_clock::time_point* deadline, const char *label);
+	bool isFreeDeferred;
+	std::atomic<FREEERRORCALLBACK> freeErrorCallback; // read by the worker
+	FreeQueue pendingFrees;                        // blocks waiting for the worker
+	std::atomic<GenericObject*> reclaimedFrees;    // blocks the worker is done with
+	std::atomic<unsigned> reclaimedCount;          // number of blocks in reclaimedFrees
+	std::atomic<size_t> queuedFreeCount;           // total blocks pushed to pendingFrees
+	size_t processedFreeCount;                     // total blocks the worker went through (guarded by workerLock)
+	bool isWorkerStopping;                         // guarded by workerLock
+	std::thread freeWorker;
+	std::mutex workerLock;
+	std::condition_variable workerSignal;          // wakes the worker up
+	std::condition_variable flushSignal;           // wakes FlushDeferredFrees and waiting allocations up
+	mutable std::mutex pageLock;                   // guards PageList_ against the worker
+
+	// Grows the pool outside of its lock
+	template <typename LockPolicy> friend class SynchronizedObjectAllocator;
 
 	// Make private to prevent copy construction and assignment
 	ObjectAllocator(const ObjectAllocator &oa);
 	ObjectAllocator &operator=(const ObjectAllocator &oa);
 };
 
+inline void *ObjectAllocator::Allocate(const char *label)
+{
+	GenericObject* block = FreeList_;
+	if (OA_LIKELY(isFastPath && block)) {
+		FreeList_ = block->Next;
+		++myStats.Allocations_;
+		--myStats.FreeObjects_;
+		if (++myStats.ObjectsInUse_ > myStats.MostObjects_)
+			myStats.MostObjects_ = myStats.ObjectsInUse_;
+		return block;
+	}
+	return allocate_slow(label);
+}
+
+inline void *ObjectAllocator::BlockAt(size_t Index) const
+{
+	size_t page = Index / myConfig.ObjectsPerPage_;
+	return reservedBase + page * pageStride + leftPageSectionSize + (Index - page * myConfig.ObjectsPerPage_) * interPageSectionSize;
+}
+
+inline void ObjectAllocator::Free(void *Object)
+{
+	if (OA_LIKELY(isFastPath)) {
+		GenericObject* block = static_cast<GenericObject*>(Object);
+		block->Next = FreeList_;
+		FreeList_ = block;
+		++myStats.Deallocations_;
+		++myStats.FreeObjects_;
+		--myStats.ObjectsInUse_;
+		return;
+	}
+	free_slow(Object);
+}
+
+namespace oa
+{
+	// Frees a block without knowing which ObjectAllocator it came from (looked up in the PageMap,
+	// blocks shadow mode got from new/delete included)
+	// Throws an exception if no allocator owns the block. (Invalid object)
+	// Same threading rules as calling Free on the owner directly.
+	void Free(void *Object);
+}
+
 #endif
\ No newline at end of file
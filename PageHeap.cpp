@@ -0,0 +1,244 @@
+/*!
+* \file PageHeap.cpp
+* \brief Implementation of @b PageHeap.h
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "PageHeap.h"
+#include <mutex>
+#include <vector>
+#include <map>
+#include <new>
+#include <cstdint>
+
+namespace PageHeap
+{
+
+// Block sizes are MIN_BLOCK_SIZE << order
+static const unsigned MAX_ORDER = 10;
+static const size_t BLOCKS_PER_ARENA = MAX_BLOCK_SIZE / MIN_BLOCK_SIZE;
+static const signed char NOT_FREE = -1;
+
+// Free blocks are linked through their first bytes
+struct FreeBlock
+{
+	FreeBlock *next;
+	FreeBlock *prev;
+};
+
+struct Arena
+{
+	unsigned char *memory;           // what new[] returned
+	unsigned char *base;             // first block, aligned to MIN_BLOCK_SIZE
+	signed char freeOrder[BLOCKS_PER_ARENA]; // order of the free block starting at each MIN_BLOCK_SIZE step, NOT_FREE otherwise
+	size_t bytesInUse;
+};
+
+struct Heap
+{
+	std::mutex lock;
+	FreeBlock *freeLists[MAX_ORDER + 1];
+	std::map<unsigned char*, Arena*> arenas; // keyed by base
+	size_t footprint;
+	size_t bytesInUse;
+};
+
+/**
+* Helper function to get the heap, created on first use and never destroyed so pages can
+* be given back during static destruction
+* @return the heap
+*/
+static Heap &heap(void)
+{
+	static Heap* instance = new Heap();
+	return *instance;
+}
+
+/**
+* Helper function to find the smallest order that holds a number of bytes
+* @param size number of bytes
+* @return the order
+*/
+static unsigned order_of(size_t size)
+{
+	unsigned order = 0;
+	while ((MIN_BLOCK_SIZE << order) < size)
+		++order;
+	return order;
+}
+
+/**
+* Helper function to put a block on the free list of its order
+* @param state the heap
+* @param arena arena of the block
+* @param block the block
+* @param order order of the block
+*/
+static void push_free(Heap &state, Arena *arena, unsigned char *block, unsigned order)
+{
+	FreeBlock* freeBlock = reinterpret_cast<FreeBlock*>(block);
+	freeBlock->prev = NULL;
+	freeBlock->next = state.freeLists[order];
+	if (freeBlock->next)
+		freeBlock->next->prev = freeBlock;
+	state.freeLists[order] = freeBlock;
+	arena->freeOrder[static_cast<size_t>(block - arena->base) / MIN_BLOCK_SIZE] = static_cast<signed char>(order);
+}
+
+/**
+* Helper function to take a block off the free list of its order
+* @param state the heap
+* @param arena arena of the block
+* @param block the block
+* @param order order of the block
+*/
+static void remove_free(Heap &state, Arena *arena, unsigned char *block, unsigned order)
+{
+	FreeBlock* freeBlock = reinterpret_cast<FreeBlock*>(block);
+	if (freeBlock->prev)
+		freeBlock->prev->next = freeBlock->next;
+	else
+		state.freeLists[order] = freeBlock->next;
+	if (freeBlock->next)
+		freeBlock->next->prev = freeBlock->prev;
+	arena->freeOrder[static_cast<size_t>(block - arena->base) / MIN_BLOCK_SIZE] = NOT_FREE;
+}
+
+/**
+* Helper function to find the arena of a block
+* @param state the heap
+* @param block the block
+* @return arena of the block
+*/
+static Arena *arena_of(Heap &state, unsigned char *block)
+{
+	std::map<unsigned char*, Arena*>::iterator arena = state.arenas.upper_bound(block);
+	return (--arena)->second;
+}
+
+/**
+* Helper function to get another arena from the system, as one free block of MAX_ORDER
+* @param state the heap
+*/
+static void add_arena(Heap &state)
+{
+	Arena* arena = new Arena();
+	try {
+		arena->memory = new unsigned char[MAX_BLOCK_SIZE + MIN_BLOCK_SIZE - 1];
+	}
+	catch (std::bad_alloc &) {
+		delete arena;
+		throw;
+	}
+	uintptr_t address = reinterpret_cast<uintptr_t>(arena->memory);
+	arena->base = arena->memory + (MIN_BLOCK_SIZE - address % MIN_BLOCK_SIZE) % MIN_BLOCK_SIZE;
+	for (size_t i = 0; i < BLOCKS_PER_ARENA; ++i)
+		arena->freeOrder[i] = NOT_FREE;
+	arena->bytesInUse = 0;
+	state.arenas[arena->base] = arena;
+	state.footprint += MAX_BLOCK_SIZE;
+	push_free(state, arena, arena->base, MAX_ORDER);
+}
+
+/**
+* Gets a block of pages
+* @param size bytes needed
+* @return the block
+*/
+void *Allocate(size_t size)
+{
+	if (size > MAX_BLOCK_SIZE)
+		throw std::bad_alloc();
+
+	Heap& state = heap();
+	std::lock_guard<std::mutex> guard(state.lock);
+	unsigned order = order_of(size);
+
+	// Smallest free block that is big enough, or a new arena
+	unsigned freeOrder = order;
+	while (freeOrder <= MAX_ORDER && !state.freeLists[freeOrder])
+		++freeOrder;
+	if (freeOrder > MAX_ORDER) {
+		add_arena(state);
+		freeOrder = MAX_ORDER;
+	}
+
+	unsigned char* block = reinterpret_cast<unsigned char*>(state.freeLists[freeOrder]);
+	Arena* arena = arena_of(state, block);
+	remove_free(state, arena, block, freeOrder);
+
+	// Split it, the upper halves stay free
+	while (freeOrder > order) {
+		--freeOrder;
+		push_free(state, arena, block + (MIN_BLOCK_SIZE << freeOrder), freeOrder);
+	}
+
+	arena->bytesInUse += MIN_BLOCK_SIZE << order;
+	state.bytesInUse += MIN_BLOCK_SIZE << order;
+	return block;
+}
+
+/**
+* Gives back a block of pages, merging it with its free buddies
+* @param block the block
+* @param size bytes asked for in Allocate
+*/
+void Free(void *block, size_t size)
+{
+	if (!block)
+		return;
+
+	Heap& state = heap();
+	std::lock_guard<std::mutex> guard(state.lock);
+	unsigned order = order_of(size);
+	unsigned char* merged = static_cast<unsigned char*>(block);
+	Arena* arena = arena_of(state, merged);
+	arena->bytesInUse -= MIN_BLOCK_SIZE << order;
+	state.bytesInUse -= MIN_BLOCK_SIZE << order;
+
+	while (order < MAX_ORDER) {
+		size_t offset = static_cast<size_t>(merged - arena->base);
+		size_t buddyOffset = offset ^ (MIN_BLOCK_SIZE << order);
+		if (arena->freeOrder[buddyOffset / MIN_BLOCK_SIZE] != static_cast<signed char>(order))
+			break;
+		remove_free(state, arena, arena->base + buddyOffset, order);
+		merged = arena->base + (offset < buddyOffset ? offset : buddyOffset);
+		++order;
+	}
+
+	// An empty arena goes back to the system, unless it's the only free one left
+	if (order == MAX_ORDER && state.freeLists[MAX_ORDER]) {
+		state.arenas.erase(arena->base);
+		state.footprint -= MAX_BLOCK_SIZE;
+		delete[] arena->memory;
+		delete arena;
+		return;
+	}
+	push_free(state, arena, merged, order);
+}
+
+/**
+* Gets the bytes taken from the system
+* @return bytes in arenas
+*/
+size_t Footprint(void)
+{
+	Heap& state = heap();
+	std::lock_guard<std::mutex> guard(state.lock);
+	return state.footprint;
+}
+
+/**
+* Gets the bytes handed out
+* @return bytes in blocks that weren't given back
+*/
+size_t BytesInUse(void)
+{
+	Heap& state = heap();
+	std::lock_guard<std::mutex> guard(state.lock);
+	return state.bytesInUse;
+}
+
+}
@@ -0,0 +1,31 @@
+//---------------------------------------------------------------------------
+#ifndef PAGEHEAPH
+#define PAGEHEAPH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+
+// Process-wide heap of pages shared by every ObjectAllocator that asks for it
+// (OAConfig::UsePageHeap_). Memory is taken from the system in arenas and split with
+// a buddy system: a request gets the smallest power of two block that fits, and a
+// block that is given back merges with its free buddy, so pages one pool gives back
+// can be handed to a pool of another size. An arena that is entirely free goes back
+// to the system, except for one kept for the next request. All functions are thread safe.
+namespace PageHeap
+{
+	static const size_t MIN_BLOCK_SIZE = 4096;              // smallest block (and alignment of every block)
+	static const size_t MAX_BLOCK_SIZE = 4 * 1024 * 1024;   // largest block, the size of an arena
+
+	// Gets a block of at least size bytes (at most MAX_BLOCK_SIZE)
+	// Throws std::bad_alloc if the system is out of memory
+	void *Allocate(size_t size);
+
+	// Gives back a block from Allocate, size must be the same as in that call
+	void Free(void *block, size_t size);
+
+	// Bytes taken from the system, and bytes of those in blocks handed out
+	size_t Footprint(void);
+	size_t BytesInUse(void);
+}
+
+#endif
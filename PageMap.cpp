@@ -0,0 +1,243 @@
+/*!
+* \file PageMap.cpp
+* \brief Implementation of @b PageMap.h
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "PageMap.h"
+#include "ObjectAllocator.h"
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <cstdint>
+
+namespace PageMap
+{
+
+// 3 levels of 12 bits over 4 KiB chunks cover 48-bit addresses
+static const unsigned CHUNK_BITS = 12;
+static const unsigned LEVEL_BITS = 12;
+static const size_t LEVEL_SIZE = static_cast<size_t>(1) << LEVEL_BITS;
+static const uintptr_t CHUNK_SIZE = static_cast<uintptr_t>(1) << CHUNK_BITS;
+static const uintptr_t RANGES_TAG = 1; // the entry points to a ChunkRanges
+
+// A chunk entry is 0, the allocator of the page covering the whole chunk, or a
+// ChunkRanges tagged with RANGES_TAG when pages only cover part of the chunk
+struct PageRange
+{
+	uintptr_t begin;
+	uintptr_t end;
+	ObjectAllocator* owner;
+};
+
+// Never changed once published, writers replace the whole thing
+struct ChunkRanges
+{
+	std::vector<PageRange> pages;
+};
+
+struct Leaf
+{
+	std::atomic<uintptr_t> owners[LEVEL_SIZE];
+};
+
+struct Middle
+{
+	std::atomic<Leaf*> leaves[LEVEL_SIZE];
+};
+
+static std::atomic<Middle*> root[LEVEL_SIZE];
+
+// Writers of partly covered chunks
+static std::mutex rangesLock;
+
+// Lookups reading a ChunkRanges count themselves in the half of the current epoch.
+// A writer that replaced one moves to the next epoch and waits for the old half to
+// drain before deleting it, so only writers ever wait.
+static std::atomic<unsigned> epoch(0);
+static std::atomic<unsigned> readers[2];
+
+/**
+* Helper function to find the entry of a chunk
+* @param chunk Address shifted down by CHUNK_BITS
+* @param create Whether missing levels are created
+* @return the entry of the chunk or NULL if it doesn't exist (or can't be mapped)
+*/
+static std::atomic<uintptr_t>* find_entry(uintptr_t chunk, bool create)
+{
+	uintptr_t rootIndex = chunk >> (LEVEL_BITS * 2);
+	if (rootIndex >= LEVEL_SIZE)
+		return NULL; // beyond 48 bits
+
+	Middle* middle = root[rootIndex].load(std::memory_order_acquire);
+	if (!middle) {
+		if (!create)
+			return NULL;
+		Middle* newMiddle = new Middle();
+		if (root[rootIndex].compare_exchange_strong(middle, newMiddle, std::memory_order_acq_rel))
+			middle = newMiddle;
+		else
+			delete newMiddle; // someone else got there first, middle is theirs now
+	}
+
+	std::atomic<Leaf*>& leafSlot = middle->leaves[(chunk >> LEVEL_BITS) & (LEVEL_SIZE - 1)];
+	Leaf* leaf = leafSlot.load(std::memory_order_acquire);
+	if (!leaf) {
+		if (!create)
+			return NULL;
+		Leaf* newLeaf = new Leaf();
+		if (leafSlot.compare_exchange_strong(leaf, newLeaf, std::memory_order_acq_rel))
+			leaf = newLeaf;
+		else
+			delete newLeaf;
+	}
+
+	return &leaf->owners[chunk & (LEVEL_SIZE - 1)];
+}
+
+/**
+* Helper function to get the ranges an entry points to
+* @param value value of a chunk entry
+* @return the ranges or NULL if the entry holds an allocator (or nothing)
+*/
+static ChunkRanges* ranges_of(uintptr_t value)
+{
+	return (value & RANGES_TAG) ? reinterpret_cast<ChunkRanges*>(value & ~RANGES_TAG) : NULL;
+}
+
+/**
+* Helper function to replace the ranges of a chunk, must be called with rangesLock
+* @param entry entry of the chunk
+* @param ranges new ranges (NULL or empty clears the entry), deleted if empty
+*/
+static void publish_ranges(std::atomic<uintptr_t>* entry, ChunkRanges* ranges)
+{
+	ChunkRanges* old = ranges_of(entry->load(std::memory_order_relaxed));
+	if (ranges && ranges->pages.empty()) {
+		delete ranges;
+		ranges = NULL;
+	}
+	entry->store(ranges ? reinterpret_cast<uintptr_t>(ranges) | RANGES_TAG : 0);
+	if (!old)
+		return;
+
+	// Lookups that started from now on can't see the old ranges, wait for the rest
+	unsigned previous = epoch.fetch_add(1);
+	while (readers[previous & 1].load() != 0)
+		std::this_thread::yield();
+	delete old;
+}
+
+/**
+* Marks every chunk of a page as belonging to its allocator
+* @param PageBegin first byte of the page
+* @param PageSize size of the page
+* @param Owner allocator the page belongs to
+*/
+void Register(const void * PageBegin, size_t PageSize, ObjectAllocator * Owner)
+{
+	uintptr_t begin = reinterpret_cast<uintptr_t>(PageBegin);
+	uintptr_t end = begin + PageSize;
+	for (uintptr_t chunk = begin >> CHUNK_BITS; chunk <= (end - 1) >> CHUNK_BITS; ++chunk) {
+		std::atomic<uintptr_t>* entry = find_entry(chunk, true);
+		if (!entry)
+			continue; // Find gives NULL there
+		uintptr_t chunkBegin = chunk << CHUNK_BITS;
+		if (begin <= chunkBegin && chunkBegin + CHUNK_SIZE <= end) {
+			// Nothing else can be in the chunk
+			entry->store(reinterpret_cast<uintptr_t>(Owner), std::memory_order_release);
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(rangesLock);
+		ChunkRanges* old = ranges_of(entry->load(std::memory_order_relaxed));
+		ChunkRanges* ranges = new ChunkRanges();
+		if (old)
+			ranges->pages = old->pages;
+		PageRange range = { begin, end, Owner };
+		ranges->pages.push_back(range);
+		publish_ranges(entry, ranges);
+	}
+}
+
+/**
+* Forgets every chunk (or the part of it) the page was using
+* @param PageBegin first byte of the page
+* @param PageSize size of the page
+* @param Owner allocator the page belonged to
+*/
+void Unregister(const void * PageBegin, size_t PageSize, ObjectAllocator * Owner)
+{
+	uintptr_t begin = reinterpret_cast<uintptr_t>(PageBegin);
+	uintptr_t end = begin + PageSize;
+	for (uintptr_t chunk = begin >> CHUNK_BITS; chunk <= (end - 1) >> CHUNK_BITS; ++chunk) {
+		std::atomic<uintptr_t>* entry = find_entry(chunk, false);
+		if (!entry)
+			continue;
+		uintptr_t chunkBegin = chunk << CHUNK_BITS;
+		if (begin <= chunkBegin && chunkBegin + CHUNK_SIZE <= end) {
+			uintptr_t owner = reinterpret_cast<uintptr_t>(Owner);
+			entry->compare_exchange_strong(owner, 0, std::memory_order_release);
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(rangesLock);
+		ChunkRanges* old = ranges_of(entry->load(std::memory_order_relaxed));
+		if (!old)
+			continue;
+		ChunkRanges* ranges = new ChunkRanges();
+		for (size_t i = 0; i < old->pages.size(); ++i) {
+			if (old->pages[i].begin != begin || old->pages[i].owner != Owner)
+				ranges->pages.push_back(old->pages[i]);
+		}
+		publish_ranges(entry, ranges);
+	}
+}
+
+/**
+* Finds the allocator whose page the address is on
+* @param Address address to look up
+* @return the allocator or NULL
+*/
+ObjectAllocator * Find(const void * Address)
+{
+	uintptr_t address = reinterpret_cast<uintptr_t>(Address);
+	std::atomic<uintptr_t>* entry = find_entry(address >> CHUNK_BITS, false);
+	if (!entry)
+		return NULL;
+	uintptr_t value = entry->load(std::memory_order_acquire);
+	if (!ranges_of(value))
+		return reinterpret_cast<ObjectAllocator*>(value);
+
+	// Count this lookup in the current epoch, the entry has to be read again after that
+	unsigned current;
+	for (;;) {
+		current = epoch.load();
+		readers[current & 1].fetch_add(1);
+		if (epoch.load() == current)
+			break;
+		readers[current & 1].fetch_sub(1);
+	}
+
+	ObjectAllocator* owner = NULL;
+	value = entry->load();
+	ChunkRanges* ranges = ranges_of(value);
+	if (!ranges)
+		owner = reinterpret_cast<ObjectAllocator*>(value);
+	else {
+		for (size_t i = 0; i < ranges->pages.size(); ++i) {
+			if (ranges->pages[i].begin <= address && address < ranges->pages[i].end) {
+				owner = ranges->pages[i].owner;
+				break;
+			}
+		}
+	}
+
+	readers[current & 1].fetch_sub(1, std::memory_order_release);
+	return owner;
+}
+
+}
@@ -0,0 +1,22 @@
+//---------------------------------------------------------------------------
+#ifndef PAGEMAPH
+#define PAGEMAPH
+//---------------------------------------------------------------------------
+
+#include <cstddef>
+
+class ObjectAllocator;
+
+// Process-wide radix map from addresses to the ObjectAllocator whose page is there.
+// Addresses are tracked in 4 KiB chunks. A chunk a page covers completely holds its
+// allocator, a chunk pages only partly cover holds the address range of each of them,
+// so two allocators can share a chunk and lookups are still exact.
+// Lookups never take a lock. Addresses beyond 48 bits aren't tracked (Find gives NULL).
+namespace PageMap
+{
+	void Register(const void *PageBegin, size_t PageSize, ObjectAllocator *Owner);   // called for each new page
+	void Unregister(const void *PageBegin, size_t PageSize, ObjectAllocator *Owner); // called for each page released
+	ObjectAllocator *Find(const void *Address);       // NULL if no allocator owns the address
+}
+
+#endif
@@ -0,0 +1,570 @@
+//---------------------------------------------------------------------------
+#ifndef POOLCONTAINERSH
+#define POOLCONTAINERSH
+//---------------------------------------------------------------------------
+
+#include "SynchronizedObjectAllocator.h"
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <new>
+
+// Containers whose nodes come from an ObjectAllocator and link to each other with
+// 32-bit slots instead of pointers (the driver's Employee::Next, with half the link size):
+//
+//   PoolList<Employee> staff;
+//   Slot s = staff.PushBack(employee);
+//   for (Slot i = staff.First(); i != NULL_SLOT; i = staff.Next(i))
+//     staff[i].Print();
+//
+// A slot stays valid until its element is removed. None of the containers can be copied.
+
+// Index of a node in a NodePool
+typedef uint32_t Slot;
+static const Slot NULL_SLOT = 0xFFFFFFFFu;
+
+// Nodes from an ObjectAllocator with reserved address space, so a slot is the block's
+// index in the range (ObjectAllocator::BlockIndex) and the node is found by arithmetic.
+// Released blocks are handed out again first, so slots stay dense. The range is
+// reserved up front for MaxPages pages (0 for the allocator's default).
+template <typename Node>
+class NodePool
+{
+public:
+	explicit NodePool(unsigned NodesPerPage = 0, unsigned MaxPages = 0) :
+		allocator(node_size(), OAConfig(false, NodesPerPage ? NodesPerPage : default_nodes_per_page(), MaxPages, false, 0,
+			OAConfig::HeaderBlockInfo(), alignof(Node) > sizeof(void*) ? static_cast<unsigned>(alignof(Node)) : 0, false, true))
+	{
+	}
+
+	// Raw memory for a node, the caller constructs it
+	// Throws an exception if the node can't be allocated
+	Slot Acquire(void)
+	{
+		void* node = allocator.Allocate();
+		size_t index = allocator.BlockIndex(node);
+		if (index >= NULL_SLOT) {
+			allocator.Free(node);
+			throw OAException(OAException::E_NO_OBJECTS, "Cannot acquire node - out of slots");
+		}
+		return static_cast<Slot>(index);
+	}
+
+	// Gives back the memory of a node the caller has destroyed
+	void Release(Slot slot)
+	{
+		allocator.Free(allocator.BlockAt(slot));
+	}
+
+	Node &operator[](Slot slot) const
+	{
+		return *static_cast<Node*>(allocator.BlockAt(slot));
+	}
+
+	const ObjectAllocator &Allocator(void) const
+	{
+		return allocator;
+	}
+
+private:
+	static const size_t DEFAULT_PAGE_SIZE = 16 * 1024;
+
+	ObjectAllocator allocator;
+
+	static size_t node_size(void)
+	{
+		// Free blocks hold the free list link, so they can't be smaller than a pointer
+		return sizeof(Node) < sizeof(void*) ? sizeof(void*) : sizeof(Node);
+	}
+
+	static unsigned default_nodes_per_page(void)
+	{
+		return node_size() < DEFAULT_PAGE_SIZE / 2 ? static_cast<unsigned>(DEFAULT_PAGE_SIZE / node_size()) : 2;
+	}
+
+	NodePool(const NodePool &);
+	NodePool &operator=(const NodePool &);
+};
+
+// Doubly linked list
+template <typename T>
+class PoolList
+{
+public:
+	explicit PoolList(unsigned NodesPerPage = 0) : pool(NodesPerPage), head(NULL_SLOT), tail(NULL_SLOT), count(0)
+	{
+	}
+
+	~PoolList(void)
+	{
+		Clear();
+	}
+
+	// Inserting throws an exception if the node can't be allocated
+	Slot PushFront(const T &value)
+	{
+		return InsertBefore(head, value);
+	}
+
+	Slot PushBack(const T &value)
+	{
+		return InsertBefore(NULL_SLOT, value);
+	}
+
+	// Inserts in front of position (at the back for NULL_SLOT)
+	Slot InsertBefore(Slot position, const T &value)
+	{
+		Slot slot = pool.Acquire();
+		Node& node = pool[slot];
+		try {
+			new (&node.value) T(value);
+		}
+		catch (...) {
+			pool.Release(slot);
+			throw;
+		}
+		node.next = position;
+		node.prev = position == NULL_SLOT ? tail : pool[position].prev;
+		if (node.prev == NULL_SLOT)
+			head = slot;
+		else
+			pool[node.prev].next = slot;
+		if (position == NULL_SLOT)
+			tail = slot;
+		else
+			pool[position].prev = slot;
+		++count;
+		return slot;
+	}
+
+	void PopFront(void)
+	{
+		Erase(head);
+	}
+
+	void PopBack(void)
+	{
+		Erase(tail);
+	}
+
+	// Removes an element, returns the slot after it
+	Slot Erase(Slot slot)
+	{
+		Node& node = pool[slot];
+		Slot next = node.next;
+		if (node.prev == NULL_SLOT)
+			head = node.next;
+		else
+			pool[node.prev].next = node.next;
+		if (node.next == NULL_SLOT)
+			tail = node.prev;
+		else
+			pool[node.next].prev = node.prev;
+		node.value.~T();
+		pool.Release(slot);
+		--count;
+		return next;
+	}
+
+	void Clear(void)
+	{
+		while (head != NULL_SLOT)
+			Erase(head);
+	}
+
+	// Walking the list, NULL_SLOT past either end
+	Slot First(void) const { return head; }
+	Slot Last(void) const { return tail; }
+	Slot Next(Slot slot) const { return pool[slot].next; }
+	Slot Prev(Slot slot) const { return pool[slot].prev; }
+
+	T &operator[](Slot slot) { return pool[slot].value; }
+	const T &operator[](Slot slot) const { return pool[slot].value; }
+	T &Front(void) { return pool[head].value; }
+	T &Back(void) { return pool[tail].value; }
+
+	size_t Size(void) const { return count; }
+	bool IsEmpty(void) const { return count == 0; }
+	const ObjectAllocator &Allocator(void) const { return pool.Allocator(); }
+
+private:
+	struct Node
+	{
+		Slot next;
+		Slot prev;
+		T value;
+	};
+
+	NodePool<Node> pool;
+	Slot head;
+	Slot tail;
+	size_t count;
+
+	PoolList(const PoolList &);
+	PoolList &operator=(const PoolList &);
+};
+
+// Hash map with open addressing. The table only holds 4-byte slots of the entries, which
+// live in the pool, so it can be kept sparse cheaply. Collisions probe linearly and erasing
+// shifts the rest of the run back instead of leaving tombstones.
+template <typename K, typename V, typename Hash = std::hash<K> >
+class PoolHashMap
+{
+public:
+	explicit PoolHashMap(unsigned NodesPerPage = 0) : pool(NodesPerPage), table(MIN_TABLE_SIZE, NULL_SLOT), count(0)
+	{
+	}
+
+	~PoolHashMap(void)
+	{
+		Clear();
+	}
+
+	// Adds key or replaces its value, returns whether it was added
+	// Throws an exception if the node can't be allocated
+	bool Insert(const K &key, const V &value)
+	{
+		uint32_t hash = hash_of(key);
+		size_t index = find_index(key, hash);
+		if (table[index] != NULL_SLOT) {
+			pool[table[index]].value = value;
+			return false;
+		}
+
+		// Keep the load factor under 3/4 so runs stay short
+		if ((count + 1) * 4 > table.size() * 3) {
+			grow();
+			index = find_index(key, hash);
+		}
+
+		Slot slot = pool.Acquire();
+		Node& node = pool[slot];
+		try {
+			new (&node.key) K(key);
+			try {
+				new (&node.value) V(value);
+			}
+			catch (...) {
+				node.key.~K();
+				throw;
+			}
+		}
+		catch (...) {
+			pool.Release(slot);
+			throw;
+		}
+		node.hash = hash;
+		table[index] = slot;
+		++count;
+		return true;
+	}
+
+	// The value of key, NULL if it isn't in the map
+	V *Find(const K &key)
+	{
+		Slot slot = table[find_index(key, hash_of(key))];
+		return slot == NULL_SLOT ? NULL : &pool[slot].value;
+	}
+
+	const V *Find(const K &key) const
+	{
+		return const_cast<PoolHashMap*>(this)->Find(key);
+	}
+
+	// Removes key, returns whether it was in the map
+	bool Erase(const K &key)
+	{
+		size_t index = find_index(key, hash_of(key));
+		Slot slot = table[index];
+		if (slot == NULL_SLOT)
+			return false;
+		destroy(slot);
+
+		// Move back entries of the run that can't be found past the hole anymore
+		size_t mask = table.size() - 1;
+		size_t hole = index;
+		for (size_t next = (index + 1) & mask; table[next] != NULL_SLOT; next = (next + 1) & mask) {
+			size_t home = pool[table[next]].hash & mask;
+			if (((next - home) & mask) >= ((next - hole) & mask)) {
+				table[hole] = table[next];
+				hole = next;
+			}
+		}
+		table[hole] = NULL_SLOT;
+		--count;
+		return true;
+	}
+
+	void Clear(void)
+	{
+		for (size_t i = 0; i < table.size(); ++i) {
+			if (table[i] != NULL_SLOT) {
+				destroy(table[i]);
+				table[i] = NULL_SLOT;
+			}
+		}
+		count = 0;
+	}
+
+	// Calls visit(key, value) for every entry, in no particular order
+	template <typename Visitor>
+	void ForEach(Visitor visit)
+	{
+		for (size_t i = 0; i < table.size(); ++i)
+			if (table[i] != NULL_SLOT)
+				visit(pool[table[i]].key, pool[table[i]].value);
+	}
+
+	size_t Size(void) const { return count; }
+	bool IsEmpty(void) const { return count == 0; }
+	const ObjectAllocator &Allocator(void) const { return pool.Allocator(); }
+
+	// Longest run of used entries in the table, the most a lookup may have to probe
+	size_t LongestRun(void) const
+	{
+		size_t longest = 0, run = 0;
+		// Twice around, a run can wrap from the end of the table to the start
+		for (size_t i = 0; i < table.size() * 2 && run < table.size(); ++i) {
+			run = table[i & (table.size() - 1)] == NULL_SLOT ? 0 : run + 1;
+			if (run > longest)
+				longest = run;
+		}
+		return longest;
+	}
+
+private:
+	static const size_t MIN_TABLE_SIZE = 16; // must be a power of 2
+
+	struct Node
+	{
+		uint32_t hash; // kept so growing and erasing don't hash again
+		K key;
+		V value;
+	};
+
+	NodePool<Node> pool;
+	std::vector<Slot> table; // size is a power of 2
+	size_t count;
+	Hash hasher;
+
+	uint32_t hash_of(const K &key) const
+	{
+		size_t hash = hasher(key);
+		// Fold the upper half in, std::hash of integers is often the identity. Then the
+		// murmur3 finalizer, the table is indexed with the low bits and a plain multiply
+		// leaves them zero for keys that are multiples of a power of 2 (aligned pointers).
+		uint32_t mixed = static_cast<uint32_t>(hash ^ (static_cast<uint64_t>(hash) >> 32));
+		mixed ^= mixed >> 16;
+		mixed *= 0x85EBCA6Bu;
+		mixed ^= mixed >> 13;
+		mixed *= 0xC2B2AE35u;
+		mixed ^= mixed >> 16;
+		return mixed;
+	}
+
+	// Index of key's slot, or of the empty entry where it would go
+	size_t find_index(const K &key, uint32_t hash) const
+	{
+		size_t mask = table.size() - 1;
+		size_t index = hash & mask;
+		while (table[index] != NULL_SLOT) {
+			const Node& node = pool[table[index]];
+			if (node.hash == hash && node.key == key)
+				break;
+			index = (index + 1) & mask;
+		}
+		return index;
+	}
+
+	void grow(void)
+	{
+		std::vector<Slot> bigger(table.size() * 2, NULL_SLOT);
+		size_t mask = bigger.size() - 1;
+		for (size_t i = 0; i < table.size(); ++i) {
+			if (table[i] == NULL_SLOT)
+				continue;
+			size_t index = pool[table[i]].hash & mask;
+			while (bigger[index] != NULL_SLOT)
+				index = (index + 1) & mask;
+			bigger[index] = table[i];
+		}
+		table.swap(bigger);
+	}
+
+	void destroy(Slot slot)
+	{
+		Node& node = pool[slot];
+		node.value.~V();
+		node.key.~K();
+		pool.Release(slot);
+	}
+
+	PoolHashMap(const PoolHashMap &);
+	PoolHashMap &operator=(const PoolHashMap &);
+};
+
+// Bounded lock-free queue, any number of threads can enqueue and dequeue. All the nodes
+// are taken from the pool up front, so the slots never change while threads use them.
+// Unused nodes are on a stack whose top is a slot plus a counter in one 64-bit word,
+// which a pointer link couldn't fit in, so a node popped and pushed back in between
+// doesn't fool the compare-and-swap. Slots of queued nodes go around a ring like FreeQueue.
+template <typename T>
+class PoolQueue
+{
+public:
+	// Capacity is rounded up to a power of 2
+	// Throws an exception if the nodes can't be allocated
+	explicit PoolQueue(size_t Capacity) : capacity(round_up(Capacity)), pool(static_cast<unsigned>(capacity), 1),
+		cells(NULL), freeTop(NULL_SLOT), head(0), tail(0)
+	{
+		for (size_t i = 0; i < capacity; ++i)
+			new (&pool[pool.Acquire()].next) std::atomic<Slot>(NULL_SLOT);
+		cells = new Cell[capacity];
+		for (size_t i = 0; i < capacity; ++i) {
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+			cells[i].slot = NULL_SLOT;
+		}
+		// Slots are 0..capacity-1 from a fresh pool, push them so slot 0 is on top
+		for (size_t i = capacity; i-- > 0; )
+			push_free(static_cast<Slot>(i));
+	}
+
+	// Only call when no other thread uses the queue anymore
+	~PoolQueue(void)
+	{
+		for (size_t position = head.load(std::memory_order_relaxed); position != tail.load(std::memory_order_relaxed); ++position)
+			pool[cells[position & (capacity - 1)].slot].value.~T();
+		delete[] cells;
+		for (size_t i = 0; i < capacity; ++i)
+			pool.Release(static_cast<Slot>(i));
+	}
+
+	// Returns false if the queue is full
+	bool TryEnqueue(const T &value)
+	{
+		Slot slot = pop_free();
+		if (slot == NULL_SLOT)
+			return false;
+		try {
+			new (&pool[slot].value) T(value);
+		}
+		catch (...) {
+			push_free(slot);
+			throw;
+		}
+
+		// A node was free, so the ring has room once the dequeue a lap behind hands its cell over
+		size_t position = tail.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;) {
+			cell = &cells[position & (capacity - 1)];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			ptrdiff_t difference = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position);
+			if (difference == 0) {
+				if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0) {
+				CpuRelax();
+				position = tail.load(std::memory_order_relaxed);
+			}
+			else {
+				position = tail.load(std::memory_order_relaxed);
+			}
+		}
+		cell->slot = slot;
+		cell->sequence.store(position + 1, std::memory_order_release);
+		return true;
+	}
+
+	// Returns false if the queue is empty
+	bool TryDequeue(T &value)
+	{
+		size_t position = head.load(std::memory_order_relaxed);
+		Cell* cell;
+		for (;;) {
+			cell = &cells[position & (capacity - 1)];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			ptrdiff_t difference = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position + 1);
+			if (difference == 0) {
+				if (head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			}
+			else if (difference < 0) {
+				return false;
+			}
+			else {
+				position = head.load(std::memory_order_relaxed);
+			}
+		}
+		Slot slot = cell->slot;
+		// Hand the cell over to the enqueue that is one lap ahead
+		cell->sequence.store(position + capacity, std::memory_order_release);
+
+		T& queued = pool[slot].value;
+		value = queued;
+		queued.~T();
+		push_free(slot);
+		return true;
+	}
+
+	size_t Capacity(void) const { return capacity; }
+	const ObjectAllocator &Allocator(void) const { return pool.Allocator(); }
+
+private:
+	struct Node
+	{
+		std::atomic<Slot> next; // next unused node
+		T value;                // only constructed while queued
+	};
+
+	struct Cell
+	{
+		std::atomic<size_t> sequence;
+		Slot slot;
+	};
+
+	size_t capacity;
+	NodePool<Node> pool;
+	Cell* cells;
+	std::atomic<uint64_t> freeTop; // counter << 32 | slot
+	std::atomic<size_t> head;      // next cell to dequeue
+	std::atomic<size_t> tail;      // next cell to enqueue
+
+	static size_t round_up(size_t Capacity)
+	{
+		size_t size = 1;
+		while (size < Capacity)
+			size <<= 1;
+		return size;
+	}
+
+	void push_free(Slot slot)
+	{
+		uint64_t top = freeTop.load(std::memory_order_relaxed);
+		uint64_t newTop;
+		do {
+			pool[slot].next.store(static_cast<Slot>(top), std::memory_order_relaxed);
+			newTop = ((top >> 32) + 1) << 32 | slot;
+		} while (!freeTop.compare_exchange_weak(top, newTop, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	Slot pop_free(void)
+	{
+		uint64_t top = freeTop.load(std::memory_order_acquire);
+		for (;;) {
+			Slot slot = static_cast<Slot>(top);
+			if (slot == NULL_SLOT)
+				return NULL_SLOT;
+			// The node may be popped and pushed again meanwhile, then the counter won't match
+			uint64_t newTop = ((top >> 32) + 1) << 32 | pool[slot].next.load(std::memory_order_relaxed);
+			if (freeTop.compare_exchange_weak(top, newTop, std::memory_order_acquire, std::memory_order_acquire))
+				return slot;
+		}
+	}
+
+	PoolQueue(const PoolQueue &);
+	PoolQueue &operator=(const PoolQueue &);
+};
+
+#endif
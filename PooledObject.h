@@ -0,0 +1,104 @@
+//---------------------------------------------------------------------------
+#ifndef POOLEDOBJECTH
+#define POOLEDOBJECTH
+//---------------------------------------------------------------------------
+
+#include "ThreadCachedAllocator.h"
+#include "PageMap.h"
+#include <new>
+
+// Mixin that makes new/delete of a class use a pool:
+//
+//   class Student : public PooledObject<Student> { ... };
+//   Student *s = new Student; // from the Student pool
+//   delete s;                 // back to it
+//
+// Every class gets its own ThreadCachedAllocator, created on the first new. Classes
+// derived from T that are bigger than T (and arrays) still go to the global new/delete.
+// The pool is never destroyed, so objects can be deleted during static destruction.
+// Blocks are aligned to alignof(T), over-aligned classes included. new (std::nothrow)
+// uses the pool too and gives NULL instead of throwing; placement new works as usual.
+template <typename T, unsigned ObjectsPerPage = 0>
+class PooledObject
+{
+public:
+	static void *operator new(size_t size)
+	{
+		if (size != sizeof(T))
+			return ::operator new(size);
+		try {
+			return Pool().Allocate();
+		}
+		catch (OAException &) {
+			throw std::bad_alloc();
+		}
+	}
+
+	static void operator delete(void *Object, size_t size)
+	{
+		if (!Object)
+			return;
+		if (size != sizeof(T))
+			::operator delete(Object);
+		else
+			Pool().Free(Object);
+	}
+
+	static void *operator new(size_t size, const std::nothrow_t &) noexcept
+	{
+		if (size != sizeof(T))
+			return ::operator new(size, std::nothrow);
+		try {
+			return Pool().Allocate();
+		}
+		catch (...) {
+			return NULL;
+		}
+	}
+
+	// Only called when a constructor throws after new (std::nothrow), there's no size to go by
+	static void operator delete(void *Object, const std::nothrow_t &) noexcept
+	{
+		if (PageMap::Find(Object) == &Pool().Pool().Unsynchronized())
+			Pool().Free(Object);
+		else
+			::operator delete(Object);
+	}
+
+	// Declaring any operator new in the class hides the global placement forms
+	static void *operator new(size_t, void *place) noexcept
+	{
+		return place;
+	}
+
+	static void operator delete(void *, void *) noexcept
+	{
+	}
+
+	// The pool of T
+	static ThreadCachedAllocator &Pool(void)
+	{
+		static ThreadCachedAllocator *pool = create_pool();
+		return *pool;
+	}
+
+protected:
+	PooledObject(void) {}
+	~PooledObject(void) {}
+
+private:
+	static const size_t DEFAULT_PAGE_SIZE = 16 * 1024;
+
+	static ThreadCachedAllocator *create_pool(void)
+	{
+		// Free blocks hold the free list link, so they can't be smaller than a pointer
+		size_t objectSize = sizeof(T) < sizeof(void*) ? sizeof(void*) : sizeof(T);
+		unsigned objectsPerPage = ObjectsPerPage;
+		if (!objectsPerPage)
+			objectsPerPage = objectSize < DEFAULT_PAGE_SIZE / 2 ? static_cast<unsigned>(DEFAULT_PAGE_SIZE / objectSize) : 2;
+		OAConfig config(false, objectsPerPage, 0, false, 0, OAConfig::HeaderBlockInfo(), static_cast<unsigned>(alignof(T)));
+		return new ThreadCachedAllocator(objectSize, config);
+	}
+};
+
+#endif
@@ -0,0 +1,325 @@
+//---------------------------------------------------------------------------
+#ifndef SYNCHRONIZEDOBJECTALLOCATORH
+#define SYNCHRONIZEDOBJECTALLOCATORH
+//---------------------------------------------------------------------------
+
+#include "ObjectAllocator.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <condition_variable>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// Tells the CPU we're spinning (frees up the core for the other hyper-thread)
+inline void CpuRelax(void)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	__builtin_ia32_pause();
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	_mm_pause();
+#else
+	std::this_thread::yield();
+#endif
+}
+
+// Lock policies for SynchronizedObjectAllocator. Each one has lock/unlock so it
+// can be used with std::lock_guard.
+
+// No locking at all, for allocators that are only used by one thread
+class NoLock
+{
+public:
+	void lock(void) {}
+	void unlock(void) {}
+};
+
+// Test-and-test-and-set spinlock with exponential backoff
+class SpinLock
+{
+public:
+	SpinLock(void) : locked(false) {}
+
+	void lock(void)
+	{
+		unsigned backoff = 1;
+		for (;;) {
+			if (!locked.exchange(true, std::memory_order_acquire))
+				return;
+			// Spin on a plain load so the cache line isn't bounced around while it's held
+			while (locked.load(std::memory_order_relaxed)) {
+				if (backoff < MAX_BACKOFF) {
+					for (unsigned i = 0; i < backoff; ++i)
+						CpuRelax();
+					backoff <<= 1;
+				}
+				else {
+					// Held for a long time, the holder is probably not running
+					std::this_thread::yield();
+				}
+			}
+		}
+	}
+
+	void unlock(void)
+	{
+		locked.store(false, std::memory_order_release);
+	}
+
+private:
+	static const unsigned MAX_BACKOFF = 1024;
+	std::atomic<bool> locked;
+
+	SpinLock(const SpinLock &);
+	SpinLock &operator=(const SpinLock &);
+};
+
+// Ticket lock, first come first served
+class TicketLock
+{
+public:
+	TicketLock(void) : nextTicket(0), nowServing(0) {}
+
+	void lock(void)
+	{
+		unsigned ticket = nextTicket.fetch_add(1, std::memory_order_relaxed);
+		unsigned spins = 0;
+		for (;;) {
+			unsigned serving = nowServing.load(std::memory_order_acquire);
+			if (serving == ticket)
+				return;
+			// Back off in proportion to how many are in front of us. Give up the CPU after
+			// a while, the holder (or the next in line) might be waiting for it.
+			if (++spins > MAX_SPINS) {
+				std::this_thread::yield();
+			}
+			else {
+				for (unsigned i = 0; i < (ticket - serving) * 16; ++i)
+					CpuRelax();
+			}
+		}
+	}
+
+	void unlock(void)
+	{
+		nowServing.store(nowServing.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+private:
+	static const unsigned MAX_SPINS = 64;
+	std::atomic<unsigned> nextTicket;
+	std::atomic<unsigned> nowServing;
+
+	TicketLock(const TicketLock &);
+	TicketLock &operator=(const TicketLock &);
+};
+
+// Blocking lock
+typedef std::mutex MutexLock;
+
+// ObjectAllocator that can be shared between threads. Every call takes the lock,
+// so the stats are updated inside the critical section. When the pool has to grow,
+// the page memory is allocated with the lock released. AllocateWait/AllocateFor
+// block until another thread frees a block when max pages has been reached.
+template <typename LockPolicy>
+class SynchronizedObjectAllocator
+{
+public:
+	typedef LockPolicy LockType;
+
+	// Same as ObjectAllocator
+	SynchronizedObjectAllocator(size_t ObjectSize, const OAConfig& config) : allocator(ObjectSize, config), waiters(0) {}
+
+	// Same as ObjectAllocator::Allocate
+	void *Allocate(const char *label = 0)
+	{
+		{
+			std::lock_guard<LockPolicy> guard(lock);
+			if (allocator.FreeList_ || allocator.ZeroList_ || allocator.isFreeDeferred || allocator.myConfig.UseCPPMemManager_
+				|| allocator.reservedBase || allocator.is_at_max_pages()) // committing a reserved page is cheap
+				return allocator.Allocate(label);
+		}
+
+		// Slow path: get the memory without holding the lock
+		unsigned char* newPage = allocator.new_page_memory();
+
+		std::lock_guard<LockPolicy> guard(lock);
+		if (allocator.FreeList_ || allocator.ZeroList_) // Someone else grew the pool in the meantime
+			allocator.release_page_memory(newPage);
+		else
+			allocator.add_page(newPage);
+		return allocator.Allocate(label);
+	}
+
+	// Same as Allocate, but when max pages has been reached it waits until Free or
+	// FreeEmptyPages makes room (or the deferred free thread gives a block back).
+	// AllocateFor throws E_NO_PAGES if there was no room within the timeout.
+	void *AllocateWait(const char *label = 0)
+	{
+		return allocate_waiting(NULL, label);
+	}
+
+	void *AllocateFor(std::chrono::milliseconds timeout, const char *label = 0)
+	{
+		std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + timeout;
+		return allocate_waiting(&deadline, label);
+	}
+
+	// Same as ObjectAllocator::AllocateZeroed (a new page is allocated under the lock)
+	void *AllocateZeroed(const char *label = 0)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.AllocateZeroed(label);
+	}
+
+	// Same as ObjectAllocator::ZeroFreeObjects, keep max small since it holds the lock
+	unsigned ZeroFreeObjects(unsigned max)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.ZeroFreeObjects(max);
+	}
+
+	unsigned SortFreeList(void)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.SortFreeList();
+	}
+
+	// Same as ObjectAllocator::Free
+	void Free(void *Object)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		allocator.Free(Object);
+		if (waiters)
+			freed.notify_all();
+	}
+
+	// Frees count blocks under one lock. If one of them throws, the ones before it are freed.
+	void FreeBatch(void *const *Objects, unsigned count)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		try {
+			for (unsigned i = 0; i < count; ++i)
+				allocator.Free(Objects[i]);
+		}
+		catch (...) {
+			if (waiters)
+				freed.notify_all();
+			throw;
+		}
+		if (waiters)
+			freed.notify_all();
+	}
+
+	unsigned DumpMemoryInUse(ObjectAllocator::DUMPCALLBACK fn)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.DumpMemoryInUse(fn);
+	}
+
+	unsigned ValidatePages(ObjectAllocator::VALIDATECALLBACK fn)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.ValidatePages(fn);
+	}
+
+	unsigned FreeEmptyPages(void)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		unsigned pages = allocator.FreeEmptyPages();
+		if (pages && waiters)
+			freed.notify_all();
+		return pages;
+	}
+
+	void SetDebugState(bool State)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		allocator.SetDebugState(State);
+	}
+
+	void Tick(void)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		allocator.Tick();
+	}
+
+	unsigned AdviseColdPages(unsigned idleTicks, bool pageOut = false)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.AdviseColdPages(idleTicks, pageOut);
+	}
+
+	OAConfig GetConfig(void)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.GetConfig();
+	}
+
+	OAStats GetStats(void)
+	{
+		std::lock_guard<LockPolicy> guard(lock);
+		return allocator.GetStats();
+	}
+
+	// The allocator underneath, for anything that isn't wrapped (take Lock() first)
+	ObjectAllocator &Unsynchronized(void) { return allocator; }
+	LockPolicy &Lock(void) { return lock; }
+
+private:
+	LockPolicy lock;
+	ObjectAllocator allocator;
+	std::condition_variable_any freed; // notified by Free while someone waits
+	unsigned waiters;                  // threads waiting in allocate_waiting (guarded by lock)
+
+	// Whether Allocate would succeed without waiting, lock has to be held
+	bool has_room(void) const
+	{
+		return allocator.FreeList_ || allocator.ZeroList_ || allocator.reclaimedFrees.load() != NULL || !allocator.is_at_max_pages();
+	}
+
+	// Waits for room and allocates, deadline is NULL to wait forever
+	void *allocate_waiting(const std::chrono::steady_clock::time_point *deadline, const char *label)
+	{
+		for (;;) {
+			try {
+				return Allocate(label);
+			}
+			catch (OAException &e) {
+				if (e.code() != OAException::E_NO_PAGES)
+					throw;
+
+				// A Free after the failed Allocate can't notify before we wait, it needs the lock
+				std::unique_lock<LockPolicy> guard(lock);
+				if (has_room())
+					continue;
+				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+				if (deadline && now >= *deadline)
+					throw;
+
+				++waiters;
+				if (allocator.isFreeDeferred) {
+					// The deferred free thread gives blocks back without calling Free here, so look now and then
+					std::chrono::steady_clock::time_point wakeUp = now + std::chrono::milliseconds(1);
+					freed.wait_until(guard, deadline && *deadline < wakeUp ? *deadline : wakeUp);
+				}
+				else if (deadline) {
+					freed.wait_until(guard, *deadline);
+				}
+				else {
+					freed.wait(guard);
+				}
+				--waiters;
+			}
+		}
+	}
+
+	// Make private to prevent copy construction and assignment
+	SynchronizedObjectAllocator(const SynchronizedObjectAllocator &);
+	SynchronizedObjectAllocator &operator=(const SynchronizedObjectAllocator &);
+};
+
+#endif
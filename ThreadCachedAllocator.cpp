@@ -0,0 +1,219 @@
+/*!
+* \file ThreadCachedAllocator.cpp
+* \brief Implementation of @b ThreadCachedAllocator.h
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "ThreadCachedAllocator.h"
+#include <vector>
+#include <mutex>
+
+// Free blocks one thread keeps for one allocator, linked through their first bytes
+struct ThreadCachedAllocator::Magazine
+{
+	ThreadCachedAllocator *owner;
+	GenericObject *head;
+	unsigned count;
+};
+
+// Indexes of the allocators that haven't been destroyed. A thread that exits only gives
+// blocks back to those, holding lock so the allocator can't go away in the meantime.
+struct LiveAllocators
+{
+	std::mutex lock;
+	std::vector<bool> isLive; // by cacheIndex
+};
+
+/**
+* Helper function to get the live allocators, created on first use and never destroyed
+* so threads can still exit during static destruction
+* @return the live allocators
+*/
+static LiveAllocators &live_allocators(void)
+{
+	static LiveAllocators* instance = new LiveAllocators();
+	return *instance;
+}
+
+// Every cache of a thread, indexed by ThreadCachedAllocator::cacheIndex.
+// Gives everything back to the pools that are still alive when the thread exits.
+struct ThreadCachedAllocator::ThreadCache
+{
+	std::vector<Magazine> magazines;
+
+	~ThreadCache()
+	{
+		LiveAllocators& live = live_allocators();
+		std::lock_guard<std::mutex> guard(live.lock);
+		for (size_t i = 0; i < magazines.size(); ++i) {
+			if (magazines[i].owner && magazines[i].count && live.isLive[i])
+				magazines[i].owner->release(magazines[i], magazines[i].count);
+		}
+	}
+};
+
+// Indexes handed out to allocators, never reused
+static std::atomic<size_t> nextCacheIndex(0);
+
+/**
+* @brief Constructor for ThreadCachedAllocator class
+* @param ObjectSize size of the object to store
+* @param config Config file for the shared pool
+*/
+ThreadCachedAllocator::ThreadCachedAllocator(size_t ObjectSize, const OAConfig & config) : pool(ObjectSize, config),
+	cacheIndex(nextCacheIndex.fetch_add(1)), cacheSize(CACHE_SIZE)
+{
+	LiveAllocators& live = live_allocators();
+	std::lock_guard<std::mutex> guard(live.lock);
+	if (cacheIndex >= live.isLive.size())
+		live.isLive.resize(cacheIndex + 1, false);
+	live.isLive[cacheIndex] = true;
+}
+
+/**
+* @brief Destructor for ThreadCachedAllocator class
+*/
+ThreadCachedAllocator::~ThreadCachedAllocator()
+{
+	{
+		// Threads exiting from now on leave this allocator alone
+		LiveAllocators& live = live_allocators();
+		std::lock_guard<std::mutex> guard(live.lock);
+		live.isLive[cacheIndex] = false;
+	}
+
+	ThreadCache& cache = thread_cache();
+	if (cacheIndex < cache.magazines.size()) {
+		Magazine& magazine = cache.magazines[cacheIndex];
+		if (magazine.owner && magazine.count)
+			release(magazine, magazine.count);
+		magazine.owner = NULL;
+	}
+}
+
+/**
+* Takes a block from the calling thread's cache
+* @return the block
+*/
+void * ThreadCachedAllocator::Allocate(void)
+{
+	Magazine& magazine = get_magazine();
+	if (!magazine.head)
+		refill(magazine);
+
+	GenericObject* block = magazine.head;
+	magazine.head = block->Next;
+	--magazine.count;
+	return block;
+}
+
+/**
+* Puts a block in the calling thread's cache
+* @param Object block to be freed
+*/
+void ThreadCachedAllocator::Free(void * Object)
+{
+	Magazine& magazine = get_magazine();
+	GenericObject* block = reinterpret_cast<GenericObject*>(Object);
+	block->Next = magazine.head;
+	magazine.head = block;
+	unsigned size = CacheSize();
+	if (++magazine.count > size)
+		release(magazine, magazine.count - size / 2);
+}
+
+/**
+* Gives the calling thread's cached blocks back to the pool
+*/
+void ThreadCachedAllocator::FlushThreadCache(void)
+{
+	Magazine& magazine = get_magazine();
+	if (magazine.count)
+		release(magazine, magazine.count);
+}
+
+/**
+* Changes how many blocks each thread can keep
+* @param Size most blocks in a thread's cache
+*/
+void ThreadCachedAllocator::SetCacheSize(unsigned Size)
+{
+	cacheSize.store(Size ? Size : 1, std::memory_order_relaxed);
+}
+
+/**
+* Helper function to get the caches of the calling thread
+* @return the caches
+*/
+ThreadCachedAllocator::ThreadCache & ThreadCachedAllocator::thread_cache(void)
+{
+	static thread_local ThreadCache cache;
+	return cache;
+}
+
+/**
+* Helper function to find the calling thread's cache for this allocator
+* @return the cache
+*/
+ThreadCachedAllocator::Magazine & ThreadCachedAllocator::get_magazine(void)
+{
+	ThreadCache& cache = thread_cache();
+	if (cacheIndex >= cache.magazines.size()) {
+		Magazine empty = { NULL, NULL, 0 };
+		cache.magazines.resize(cacheIndex + 1, empty);
+	}
+
+	Magazine& magazine = cache.magazines[cacheIndex];
+	magazine.owner = this;
+	return magazine;
+}
+
+/**
+* Helper function to move a batch of blocks from the pool to a cache
+* @param magazine cache to be refilled
+*/
+void ThreadCachedAllocator::refill(Magazine & magazine)
+{
+	// Don't take more than half of what the cache may hold
+	unsigned batch = CacheSize() / 2;
+	if (batch > BATCH_SIZE)
+		batch = BATCH_SIZE;
+	else if (batch == 0)
+		batch = 1;
+
+	std::lock_guard<SpinLock> guard(pool.Lock());
+	for (unsigned i = 0; i < batch; ++i) {
+		void* Object;
+		try {
+			Object = pool.Unsynchronized().Allocate();
+		}
+		catch (OAException &) {
+			// Only a problem if we didn't get anything
+			if (i == 0)
+				throw;
+			break;
+		}
+		GenericObject* block = reinterpret_cast<GenericObject*>(Object);
+		block->Next = magazine.head;
+		magazine.head = block;
+		++magazine.count;
+	}
+}
+
+/**
+* Helper function to move blocks from a cache back to the pool
+* @param magazine cache to be emptied
+* @param count number of blocks to move
+*/
+void ThreadCachedAllocator::release(Magazine & magazine, unsigned count)
+{
+	std::lock_guard<SpinLock> guard(pool.Lock());
+	while (count-- && magazine.head) {
+		GenericObject* block = magazine.head;
+		magazine.head = block->Next;
+		--magazine.count;
+		pool.Unsynchronized().Free(block);
+	}
+}
@@ -0,0 +1,61 @@
+//---------------------------------------------------------------------------
+#ifndef THREADCACHEDALLOCATORH
+#define THREADCACHEDALLOCATORH
+//---------------------------------------------------------------------------
+
+#include "SynchronizedObjectAllocator.h"
+
+// Shared pool with a small cache of free blocks in front of it for every thread.
+// Allocate and Free only touch the calling thread's cache; the pool's lock is taken
+// once per batch when a cache runs dry or overflows. Blocks sitting in a cache count
+// as in use in the pool's stats, and debug checks only run when blocks go back to the
+// pool. Threads that used the allocator can outlive it, but can't use it anymore.
+class ThreadCachedAllocator
+{
+public:
+	static const unsigned CACHE_SIZE = 64;  // default for the most blocks a thread keeps for one allocator
+	static const unsigned BATCH_SIZE = 32;  // blocks moved between a cache and the pool at once
+
+	// Same as ObjectAllocator
+	ThreadCachedAllocator(size_t ObjectSize, const OAConfig& config);
+
+	// Flushes the calling thread's cache. The caches of other threads forget their blocks
+	// (the pages go away with the pool) instead of giving them back when the thread exits.
+	~ThreadCachedAllocator();
+
+	// Take a block from the calling thread's cache (refilled from the pool when empty)
+	// Throws an exception if the pool can't provide any block. (Memory allocation problem)
+	void *Allocate(void);
+
+	// Puts a block in the calling thread's cache (half of it goes back to the pool when full)
+	void Free(void *Object);
+
+	// Gives the calling thread's cached blocks back to the pool
+	void FlushThreadCache(void);
+
+	// Most blocks a thread keeps (at least 1). Caches that hold more shrink on their next Free.
+	void SetCacheSize(unsigned Size);
+	unsigned CacheSize(void) const { return cacheSize.load(std::memory_order_relaxed); }
+
+	// The shared pool underneath
+	SynchronizedObjectAllocator<SpinLock> &Pool(void) { return pool; }
+
+private:
+	struct Magazine;
+	struct ThreadCache;
+
+	SynchronizedObjectAllocator<SpinLock> pool;
+	size_t cacheIndex; // slot of this allocator in every thread's cache
+	std::atomic<unsigned> cacheSize;
+
+	static ThreadCache &thread_cache(void);
+	Magazine &get_magazine(void);
+	void refill(Magazine &magazine);
+	void release(Magazine &magazine, unsigned count);
+
+	// Make private to prevent copy construction and assignment
+	ThreadCachedAllocator(const ThreadCachedAllocator &);
+	ThreadCachedAllocator &operator=(const ThreadCachedAllocator &);
+};
+
+#endif
@@ -0,0 +1,329 @@
+/*!
+* \file advisor.cpp
+* \brief Recommends an OAConfig for a recorded workload
+*
+* Replays a workload on ObjectAllocators with every candidate config and ranks them
+* by peak footprint and time. Pages are sized by objects per page, or by a target in
+* bytes (OAConfig::PageBytes_) that fits one or more OS pages:
+*
+*   advisor [--weight w] [--header type] trace            a trace (see AllocationTrace.h)
+*   advisor [--weight w] [--header type] --stats samples  sampled stats of a running pool
+*
+* The samples file has one "<stat> <value>" per line, named like AllocatorControl's
+* pool.<name>.stats.<stat> keys. objects_in_use is required, and is turned into a trace
+* that allocates or frees blocks picked at random until each sample is reached.
+* object_size sets the size, and page_size with pages_in_use shows the footprint the
+* pool had for comparison. Other stats are ignored.
+*
+* Footprint is the most page bytes (plus external headers) alive at once. Time is ns per
+* event, and the number of new pages tells how often the pool stalled to grow. Weight
+* (0 to 1, default 0.5) is how much footprint counts against time in the score. Header
+* types are compared too, unless --header (none, basic or external) says which one the
+* pool needs.
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "ObjectAllocator.h"
+#include "AllocationTrace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+static const unsigned OBJECTS_PER_PAGE[] = { 8, 16, 32, 64, 128, 256, 512, 1024, 4096 };
+static const size_t PAGE_BYTES[] = { 4096, 16384, 65536, 2 * 1024 * 1024 };
+static const unsigned ALIGNMENTS[] = { 0, 16, 64 };
+static const OAConfig::HBLOCK_TYPE HEADERS[] = { OAConfig::hbNone, OAConfig::hbBasic, OAConfig::hbExternal };
+
+struct Result
+{
+	OAConfig config;
+	size_t pageSize;
+	unsigned mostPages;
+	size_t footprint;    // bytes
+	double nanoseconds;  // per event
+	double score;        // lower is better
+};
+
+/**
+* Helper function to name a header type
+* @param type the header type
+* @return its name
+*/
+static const char *header_name(OAConfig::HBLOCK_TYPE type)
+{
+	switch (type) {
+	case OAConfig::hbBasic:
+		return "basic";
+	case OAConfig::hbExtended:
+		return "extended";
+	case OAConfig::hbExternal:
+		return "external";
+	default:
+		return "none";
+	}
+}
+
+/**
+* Helper function to name a header type like in code
+* @param type the header type
+* @return the enumerator
+*/
+static const char *header_enumerator(OAConfig::HBLOCK_TYPE type)
+{
+	switch (type) {
+	case OAConfig::hbBasic:
+		return "OAConfig::hbBasic";
+	case OAConfig::hbExtended:
+		return "OAConfig::hbExtended";
+	case OAConfig::hbExternal:
+		return "OAConfig::hbExternal";
+	default:
+		return "OAConfig::hbNone";
+	}
+}
+
+/**
+* Helper function to turn sampled stats into a trace
+* @param fileName the samples file
+* @param trace the trace made from them
+* @param observedFootprint most page bytes the samples show (0 if they don't)
+* @return whether the file could be read
+*/
+static bool read_samples(const char *fileName, AllocationTrace &trace, size_t &observedFootprint)
+{
+	std::ifstream file(fileName);
+	if (!file) {
+		fprintf(stderr, "%s: can't open\n", fileName);
+		return false;
+	}
+
+	std::vector<unsigned> live; // block indexes
+	std::vector<unsigned> freeBlocks;
+	size_t pageSize = 0;
+	unsigned seed = 2463534242u;
+	observedFootprint = 0;
+	std::string line;
+	for (unsigned lineNumber = 1; std::getline(file, line); ++lineNumber) {
+		std::istringstream fields(line);
+		std::string stat;
+		unsigned long value;
+		if (!(fields >> stat) || stat[0] == '#')
+			continue;
+		if (!(fields >> value)) {
+			fprintf(stderr, "%s:%u: expected <stat> <number>\n", fileName, lineNumber);
+			return false;
+		}
+
+		if (stat == "object_size" && value) {
+			trace.ObjectSize = value;
+		}
+		else if (stat == "page_size") {
+			pageSize = value;
+		}
+		else if (stat == "pages_in_use") {
+			observedFootprint = std::max(observedFootprint, pageSize * value);
+		}
+		else if (stat == "objects_in_use") {
+			while (live.size() < value) {
+				unsigned block;
+				if (freeBlocks.empty()) {
+					block = trace.Blocks++;
+				}
+				else {
+					block = freeBlocks.back();
+					freeBlocks.pop_back();
+				}
+				live.push_back(block);
+				AllocationTrace::Event event = { block, true };
+				trace.Events.push_back(event);
+			}
+			while (live.size() > value) {
+				// xorshift32, a random live block goes
+				seed ^= seed << 13;
+				seed ^= seed >> 17;
+				seed ^= seed << 5;
+				size_t index = seed % live.size();
+				AllocationTrace::Event event = { live[index], false };
+				trace.Events.push_back(event);
+				freeBlocks.push_back(live[index]);
+				live[index] = live.back();
+				live.pop_back();
+			}
+		}
+	}
+	if (trace.Events.empty()) {
+		fprintf(stderr, "%s: no objects_in_use samples\n", fileName);
+		return false;
+	}
+	return true;
+}
+
+/**
+* Helper function to replay a trace on one config
+* @param trace the trace
+* @param config the config
+* @param result footprint and time of the replay
+*/
+static void simulate(const AllocationTrace &trace, const OAConfig &config, Result &result)
+{
+	ObjectAllocator allocator(trace.ObjectSize, config);
+	std::vector<void*> blocks(trace.Blocks, static_cast<void*>(NULL));
+	result.config = allocator.GetConfig(); // with the objects that fit in PageBytes_
+	result.pageSize = allocator.GetStats().PageSize_;
+	result.mostPages = 0;
+	size_t externalHeaders = config.HBlockInfo_.type_ == OAConfig::hbExternal ? sizeof(MemBlockInfo) : 0;
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < trace.Events.size(); ++i) {
+		const AllocationTrace::Event& event = trace.Events[i];
+		if (event.IsAllocation) {
+			blocks[event.Block] = allocator.Allocate();
+		}
+		else {
+			allocator.Free(blocks[event.Block]);
+			blocks[event.Block] = NULL;
+		}
+	}
+	std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+
+	OAStats stats = allocator.GetStats();
+	result.mostPages = stats.PagesInUse_; // pages are never given back during the replay
+	result.footprint = result.pageSize * result.mostPages + externalHeaders * stats.MostObjects_;
+	result.nanoseconds = elapsed.count() / static_cast<double>(trace.Events.size());
+
+	for (size_t i = 0; i < blocks.size(); ++i)
+		if (blocks[i])
+			allocator.Free(blocks[i]);
+}
+
+/**
+* Helper function to order results by score
+*/
+static bool is_better(const Result &left, const Result &right)
+{
+	return left.score < right.score;
+}
+
+int main(int argc, char **argv)
+{
+	double weight = 0.5;
+	const char* samples = NULL;
+	const char* traceFile = NULL;
+	std::vector<OAConfig::HBLOCK_TYPE> headers(HEADERS, HEADERS + sizeof(HEADERS) / sizeof(HEADERS[0]));
+	for (int i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "--weight") == 0 && i + 1 < argc) {
+			weight = atof(argv[++i]);
+		}
+		else if (strcmp(argv[i], "--header") == 0 && i + 1 < argc) {
+			const char* name = argv[++i];
+			headers.clear();
+			for (size_t h = 0; h < sizeof(HEADERS) / sizeof(HEADERS[0]); ++h)
+				if (strcmp(name, header_name(HEADERS[h])) == 0)
+					headers.push_back(HEADERS[h]);
+			if (headers.empty()) {
+				fprintf(stderr, "unknown header type %s\n", name);
+				return 1;
+			}
+		}
+		else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+			samples = argv[++i];
+		}
+		else {
+			traceFile = argv[i];
+		}
+	}
+	if ((!samples == !traceFile) || weight < 0 || weight > 1) {
+		fprintf(stderr, "usage: advisor [--weight 0..1] [--header none|basic|external] (trace | --stats samples)\n");
+		return 1;
+	}
+
+	AllocationTrace trace;
+	size_t observedFootprint = 0;
+	if (samples ? !read_samples(samples, trace, observedFootprint) : !trace.Read(traceFile))
+		return 1;
+
+	std::vector<Result> results;
+	try {
+		for (size_t h = 0; h < headers.size(); ++h) {
+			for (size_t a = 0; a < sizeof(ALIGNMENTS) / sizeof(ALIGNMENTS[0]); ++a) {
+				for (size_t o = 0; o < sizeof(OBJECTS_PER_PAGE) / sizeof(OBJECTS_PER_PAGE[0]); ++o) {
+					Result result;
+					simulate(trace, OAConfig(false, OBJECTS_PER_PAGE[o], 0, false, 0,
+						OAConfig::HeaderBlockInfo(headers[h]), ALIGNMENTS[a]), result);
+					results.push_back(result);
+				}
+				for (size_t p = 0; p < sizeof(PAGE_BYTES) / sizeof(PAGE_BYTES[0]); ++p) {
+					// Objects bigger than the page can't be sized this way
+					if (PAGE_BYTES[p] < trace.ObjectSize * 2)
+						continue;
+					Result result;
+					simulate(trace, OAConfig(false, 0, 0, false, 0, OAConfig::HeaderBlockInfo(headers[h]),
+						ALIGNMENTS[a], false, false, false, PAGE_BYTES[p]), result);
+					results.push_back(result);
+				}
+			}
+		}
+	}
+	catch (const OAException &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+
+	// Each cost relative to the best candidate, so footprint and time can be weighed
+	size_t leastFootprint = results[0].footprint;
+	double leastTime = results[0].nanoseconds;
+	for (size_t i = 1; i < results.size(); ++i) {
+		leastFootprint = std::min(leastFootprint, results[i].footprint);
+		leastTime = std::min(leastTime, results[i].nanoseconds);
+	}
+	for (size_t i = 0; i < results.size(); ++i) {
+		results[i].score = weight * static_cast<double>(results[i].footprint) / static_cast<double>(leastFootprint) +
+			(1 - weight) * results[i].nanoseconds / leastTime;
+	}
+	std::sort(results.begin(), results.end(), is_better);
+
+	unsigned mostLive = 0;
+	unsigned live = 0;
+	for (size_t i = 0; i < trace.Events.size(); ++i) {
+		if (trace.Events[i].IsAllocation)
+			mostLive = std::max(mostLive, ++live);
+		else
+			--live;
+	}
+	size_t liveBytes = mostLive * trace.ObjectSize;
+	printf("%zu events, object size %zu, most live %u (%zu bytes)\n", trace.Events.size(), trace.ObjectSize, mostLive, liveBytes);
+	if (observedFootprint)
+		printf("footprint of the sampled pool: %zu bytes\n", observedFootprint);
+
+	printf("%8s %6s %9s %10s %10s %10s %12s %9s %8s %7s\n", "per page", "align", "header", "target", "page size",
+		"new pages", "footprint", "overhead", "ns/op", "score");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result& result = results[i];
+		char target[32] = "-";
+		if (result.config.PageBytes_)
+			snprintf(target, sizeof(target), "%zu", result.config.PageBytes_);
+		printf("%8u %6u %9s %10s %10zu %10u %12zu %8.1f%% %8.2f %7.3f\n", result.config.ObjectsPerPage_, result.config.Alignment_,
+			header_name(result.config.HBlockInfo_.type_), target, result.pageSize, result.mostPages, result.footprint,
+			liveBytes ? 100.0 * static_cast<double>(result.footprint - liveBytes) / static_cast<double>(liveBytes) : 0.0,
+			result.nanoseconds, result.score);
+	}
+
+	const OAConfig& best = results[0].config;
+	if (best.PageBytes_) {
+		printf("\nrecommended: OAConfig(false, %u, 0, false, 0, OAConfig::HeaderBlockInfo(%s), %u, false, false, false, %zu)\n",
+			best.ObjectsPerPage_, header_enumerator(best.HBlockInfo_.type_), best.Alignment_, best.PageBytes_);
+	}
+	else {
+		printf("\nrecommended: OAConfig(false, %u, 0, false, 0, OAConfig::HeaderBlockInfo(%s), %u)\n",
+			best.ObjectsPerPage_, header_enumerator(best.HBlockInfo_.type_), best.Alignment_);
+	}
+	return 0;
+}
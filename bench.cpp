@@ -0,0 +1,261 @@
+/*!
+* \file bench.cpp
+* \brief Allocate/Free timings of ObjectAllocator and new/delete
+*
+* Runs a few fixed workloads and replays the traces given on the command line
+* (see AllocationTrace.h for the format), then prints ns per operation for both:
+*
+*   bench [--record file] [trace ...]
+*
+* --record writes the events of the random workload as a trace, for training
+* the PGO build when there are no recorded traces. The Makefile's lib, lto and
+* pgo targets build the same program against each kind of library.
+*
+* \copyright Digipen Institute of Technology
+*
+*/
+
+#include "ObjectAllocator.h"
+#include "AllocationTrace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <algorithm>
+
+static const size_t OBJECT_SIZE = 48;           // about a Student in the driver
+static const unsigned OBJECTS_PER_PAGE = 1024;
+static const unsigned RUNS = 3;                 // best of
+static const unsigned STRESS_BLOCKS = 256 * 1024;
+static const unsigned CHURN_OPERATIONS = 4 * 1024 * 1024;
+static const unsigned RANDOM_SLOTS = 16 * 1024;
+
+// The two contenders, with the same interface
+class PoolAllocator
+{
+public:
+	explicit PoolAllocator(size_t ObjectSize) : allocator(ObjectSize, OAConfig(false, OBJECTS_PER_PAGE, 0)) {}
+	void *Allocate(void) { return allocator.Allocate(); }
+	void Free(void *Object) { allocator.Free(Object); }
+
+private:
+	ObjectAllocator allocator;
+};
+
+class NewDeleteAllocator
+{
+public:
+	explicit NewDeleteAllocator(size_t ObjectSize) : size(ObjectSize) {}
+	void *Allocate(void) { return ::operator new(size); }
+	void Free(void *Object) { ::operator delete(Object); }
+
+private:
+	size_t size;
+};
+
+/**
+* Random numbers for the workloads, the same sequence for both allocators
+*/
+class Random
+{
+public:
+	Random(void) : state(2463534242u) {}
+	unsigned Next(void)
+	{
+		state ^= state << 13;
+		state ^= state >> 17;
+		state ^= state << 5;
+		return state;
+	}
+
+private:
+	unsigned state;
+};
+
+/**
+* Allocates and frees one block at a time, the best case for a free list
+* @param allocator allocator to be timed
+* @return number of operations
+*/
+template <typename Allocator>
+static size_t run_churn(Allocator &allocator)
+{
+	for (unsigned i = 0; i < CHURN_OPERATIONS / 2; ++i) {
+		void* Object = allocator.Allocate();
+		// Touch it like a client would, so it can't be optimized away
+		memset(Object, 0, sizeof(unsigned));
+		allocator.Free(Object);
+	}
+	return CHURN_OPERATIONS;
+}
+
+/**
+* Same as the driver's Stress: allocates a lot, frees it all in random order
+* @param allocator allocator to be timed
+* @return number of operations
+*/
+template <typename Allocator>
+static size_t run_stress(Allocator &allocator)
+{
+	std::vector<void*> blocks(STRESS_BLOCKS);
+	for (unsigned i = 0; i < STRESS_BLOCKS; ++i)
+		blocks[i] = allocator.Allocate();
+	Random random;
+	for (unsigned i = STRESS_BLOCKS - 1; i > 0; --i)
+		std::swap(blocks[i], blocks[random.Next() % (i + 1)]);
+	for (unsigned i = 0; i < STRESS_BLOCKS; ++i)
+		allocator.Free(blocks[i]);
+	return STRESS_BLOCKS * 2;
+}
+
+/**
+* Picks random slots of a table, frees the block in a full one and fills an empty one,
+* so the pool stays about half full and the free list gets shuffled
+* @param allocator allocator to be timed
+* @param record trace the events are added to (can be NULL)
+* @return number of operations
+*/
+template <typename Allocator>
+static size_t run_random(Allocator &allocator, AllocationTrace *record = NULL)
+{
+	std::vector<void*> slots(RANDOM_SLOTS, static_cast<void*>(NULL));
+	Random random;
+	for (unsigned i = 0; i < CHURN_OPERATIONS; ++i) {
+		unsigned slot = random.Next() % RANDOM_SLOTS;
+		bool isAllocation = slots[slot] == NULL;
+		if (isAllocation) {
+			slots[slot] = allocator.Allocate();
+		}
+		else {
+			allocator.Free(slots[slot]);
+			slots[slot] = NULL;
+		}
+		if (record) {
+			AllocationTrace::Event event = { slot, isAllocation };
+			record->Events.push_back(event);
+		}
+	}
+	for (unsigned slot = 0; slot < RANDOM_SLOTS; ++slot)
+		if (slots[slot])
+			allocator.Free(slots[slot]);
+	return CHURN_OPERATIONS;
+}
+
+/**
+* Replays a trace, blocks still alive at the end are freed outside of the count
+* @param allocator allocator to be timed
+* @param trace trace to be replayed
+* @return number of operations
+*/
+template <typename Allocator>
+static size_t run_trace(Allocator &allocator, const AllocationTrace &trace)
+{
+	std::vector<void*> blocks(trace.Blocks, static_cast<void*>(NULL));
+	for (size_t i = 0; i < trace.Events.size(); ++i) {
+		const AllocationTrace::Event& event = trace.Events[i];
+		if (event.IsAllocation) {
+			blocks[event.Block] = allocator.Allocate();
+		}
+		else {
+			allocator.Free(blocks[event.Block]);
+			blocks[event.Block] = NULL;
+		}
+	}
+	for (size_t i = 0; i < blocks.size(); ++i)
+		if (blocks[i])
+			allocator.Free(blocks[i]);
+	return trace.Events.size();
+}
+
+/**
+* Times a workload on a fresh allocator, best of RUNS
+* @param size object size
+* @param workload the workload
+* @return nanoseconds per operation
+*/
+template <typename Allocator, typename Workload>
+static double time_workload(size_t size, Workload workload)
+{
+	double best = 0;
+	for (unsigned run = 0; run < RUNS; ++run) {
+		Allocator allocator(size);
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		size_t operations = workload(allocator);
+		std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+		double perOperation = elapsed.count() / static_cast<double>(operations);
+		if (run == 0 || perOperation < best)
+			best = perOperation;
+	}
+	return best;
+}
+
+// Workloads as function objects, so time_workload can run them on either allocator
+struct Churn
+{
+	template <typename Allocator> size_t operator()(Allocator &allocator) const { return run_churn(allocator); }
+};
+
+struct Stress
+{
+	template <typename Allocator> size_t operator()(Allocator &allocator) const { return run_stress(allocator); }
+};
+
+struct RandomSlots
+{
+	template <typename Allocator> size_t operator()(Allocator &allocator) const { return run_random(allocator); }
+};
+
+struct Replay
+{
+	const AllocationTrace *trace;
+	template <typename Allocator> size_t operator()(Allocator &allocator) const { return run_trace(allocator, *trace); }
+};
+
+/**
+* Times a workload on both allocators and prints a line
+* @param name name of the workload
+* @param size object size
+* @param workload the workload
+*/
+template <typename Workload>
+static void compare(const std::string &name, size_t size, Workload workload)
+{
+	double pool = time_workload<PoolAllocator>(size, workload);
+	double newDelete = time_workload<NewDeleteAllocator>(size, workload);
+	printf("%-24s %10.2f %12.2f %8.2fx\n", name.c_str(), pool, newDelete, newDelete / pool);
+}
+
+int main(int argc, char **argv)
+{
+	int first = 1;
+	if (argc > 2 && strcmp(argv[1], "--record") == 0) {
+		AllocationTrace record;
+		record.ObjectSize = OBJECT_SIZE;
+		NewDeleteAllocator allocator(OBJECT_SIZE);
+		run_random(allocator, &record);
+		record.Blocks = RANDOM_SLOTS;
+		if (!record.Write(argv[2]))
+			return 1;
+		first = 3;
+	}
+
+	try {
+		printf("%-24s %10s %12s %9s\n", "workload (ns/op)", "pool", "new/delete", "speedup");
+		compare("churn", OBJECT_SIZE, Churn());
+		compare("stress", OBJECT_SIZE, Stress());
+		compare("random", OBJECT_SIZE, RandomSlots());
+		for (int i = first; i < argc; ++i) {
+			AllocationTrace trace;
+			if (!trace.Read(argv[i]))
+				return 1;
+			Replay replay = { &trace };
+			compare(argv[i], trace.ObjectSize, replay);
+		}
+	}
+	catch (const OAException &e) {
+		fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
@@ -4,6 +4,12 @@
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <stdexcept>
+#include <fstream>
+#include <string>
+#ifdef __linux__
+#include <unistd.h>
+#endif
 
 using std::cout;
 using std::endl;
@@ -15,7 +21,15 @@ int SHOWREAL = 0;
 int SHOW_EXCEPTIONS = 0;
 
 #include "ObjectAllocator.h"
+#include "SynchronizedObjectAllocator.h"
+#include "PageMap.h"
+#include "PooledObject.h"
+#include "PoolContainers.h"
 #include "PRNG.h"
+#include "AllocatorControl.h"
+#include "CoroutineFrameAllocator.h"
+#include "IOBufferPool.h"
+#include "PageHeap.h"
 
 struct Student {
     int Age;
@@ -57,6 +71,29 @@ void TestFreeEmptyPages2( void );     // debug, padding=2, header, align=16
 void TestFreeEmptyPages3( void );     // debug, padding=6
 void StressFreeChecking( void );      //
 void Stress( bool UseNewDelete );     //
+void TestMarkSweep( void );           // debug, padding=2, header, deferred free
+void TestHeaderChecksum( void );      // debug, padding=2, header, checksum
+void TestDeferredFree( void );        // debug, padding=4, header, deferred free
+void TestAllocateWait( void );        // synchronized, max pages=1
+void TestPageMap( void );             // 2 objects/page, 1024 objects/page
+void TestPooledObject( void );        // PooledObject, align=32
+void TestZeroedShadow( void );        // 4 objects/page, shadow mode
+void TestShadowCounts( void );        // 4 objects/page, shadow mode, synchronized
+void TestPoolContainers( void );      // PoolHashMap, PoolList, PoolQueue
+void TestReservedPages( void );       // debug, header, reserved address space, max pages=3
+void TestSortFreeList( void );        // 8 objects/page, sorted frees, reserved address space
+void TestDebugAtRuntime( void );      // debug turned on through AllocatorControl, padding=4
+void TestShadowOAFree( void );        // 4 objects/page, shadow mode, oa::Free, deferred free
+void TestThreadCache( void );         // ThreadCachedAllocator, 16 objects/page, cache size, threads
+void TestCoroutineFrames( void );     // CoroutineFrameAllocator, PooledFramePromise
+void TestIOBufferPool( void );        // IOBufferPool, 4 buffers/page, max pages=1
+void TestAllocatorControl( void );    // AllocatorControl, OA_CONFIG and OA_CONFIG_FILE overrides
+void TestColdPages( void );           // 4 objects/page of 4 KiB, page use tracking
+void TestDirtyPages( void );          // debug, padding=4, soft-dirty pages
+void TestValidateThreads( void );     // debug, padding=4, validation threads
+void TestLockPolicies( void );        // synchronized, 4 objects/page, lock policies, threads
+void TestPageHeap( void );            // PageHeap, buddy blocks, pools sharing pages
+void TestPageBytes( void );           // page size targets, debug, header, align=16, PageHeap
 
 struct Person {
     char lastName[12];
@@ -1343,191 +1380,1843 @@ void TestAlignment( void )
         delete oa;
 }
 
-
-void PrintCounts( const ObjectAllocator *nm )
+//****************************************************************************************************
+//****************************************************************************************************
+void FinalizeCallback( void *block, size_t )
 {
-    OAStats stats = nm->GetStats();
-    cout << "Pages in use: " << stats.PagesInUse_;
-    cout << ", Objects in use: " << stats.ObjectsInUse_;
-    cout << ", Available objects: " << stats.FreeObjects_;
-    cout << ", Allocs: " << stats.Allocations_;
-    cout << ", Frees: " << stats.Deallocations_ << endl;
+    cout << "Finalizing student " << static_cast<Student *>( block )->ID << endl;
 }
 
-void PrintCounts2( const ObjectAllocator *nm )
+void FreeErrorCallback( const void *, const OAException& e )
 {
-    OAStats stats = nm->GetStats();
-    cout << "Allocs: " << stats.Allocations_;
-    cout << ", Frees: " << stats.Deallocations_ << endl;
+    cout << "Error from deferred Free: " << e.what() << endl;
 }
 
-void PrintConfig( const ObjectAllocator *oa )
+void TestMarkSweep( void )
 {
-    cout << "Object size = " << oa->GetStats().ObjectSize_;
-    cout << ", Page size = " << oa->GetStats().PageSize_;
-    cout << ", Pad bytes = " << oa->GetConfig().PadBytes_;
-    cout << ", ObjectsPerPage = " << oa->GetConfig().ObjectsPerPage_;
-    cout << ", MaxPages = " << oa->GetConfig().MaxPages_;
-    cout << ", MaxObjects = " <<  oa->GetConfig().ObjectsPerPage_ * oa->GetConfig().MaxPages_;
-    cout << endl;
-    cout << "Alignment = " << oa->GetConfig().Alignment_;
-    cout << ", LeftAlign = " << oa->GetConfig().LeftAlignSize_;
-    cout << ", InterAlign = " << oa->GetConfig().InterAlignSize_;
-    cout << ", HeaderBlocks = ";
-    if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbNone )
-        cout << "None";
-    else if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbBasic )
-        cout << "Basic";
-    else if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbExtended )
-        cout << "Extended";
-    else if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbExternal )
-        cout << "External";
-    cout << ", Header size = " << oa->GetConfig().HBlockInfo_.size_;
-    cout << endl;
+    ObjectAllocator *oa = 0;
+    Student *students[8];
+    unsigned swept;
+    try {
+        bool newdel = false;
+        bool debug = true;
+        unsigned padbytes = 2;
+        OAConfig::HeaderBlockInfo header( OAConfig::hbBasic );
+        OAConfig config( newdel, 4, 0, debug, padbytes, header );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        for( unsigned i = 0; i < 8; i++ ) {
+            students[i] = static_cast<Student *>( oa->Allocate() );
+            students[i]->ID = static_cast<long>( i );
+        }
+        PrintCounts( oa );
+
+        // Only the even students are reachable
+        for( unsigned i = 0; i < 8; i += 2 )
+            oa->Mark( students[i] );
+        swept = oa->Sweep( FinalizeCallback );
+        cout << "Blocks swept: " << swept << endl;
+        PrintCounts( oa );
+
+        // Student 0 is still queued for the background thread when Sweep runs,
+        // so it must not be swept (freed a second time)
+        oa->SetDeferredFree( true, FreeErrorCallback );
+        oa->Free( students[0] );
+        for( unsigned i = 2; i < 8; i += 2 )
+            oa->Mark( students[i] );
+        swept = oa->Sweep( FinalizeCallback );
+        cout << "Blocks swept: " << swept << endl;
+        oa->FlushDeferredFrees();
+        PrintCounts( oa );
+        cout << "Number of corruptions: " << oa->ValidatePages( ValidateCallback ) << endl;
+
+        // Nothing marked, the rest goes
+        swept = oa->Sweep( FinalizeCallback );
+        cout << "Blocks swept: " << swept << endl;
+        oa->SetDeferredFree( false );
+        PrintCounts( oa );
+        cout << "Number of corruptions: " << oa->ValidatePages( ValidateCallback ) << endl;
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown in TestMarkSweep."  << endl;
+    }
+    if( oa )
+        delete oa;
 }
 
-void DumpPages( const ObjectAllocator *nm, unsigned width )
+//****************************************************************************************************
+//****************************************************************************************************
+void TestHeaderChecksum( void )
 {
-    const unsigned char *pages = static_cast<const unsigned char *>( nm->GetPageList() );
-    const unsigned char *realpage = pages;
-    size_t header_size = nm->GetConfig().HBlockInfo_.size_;
-    while( pages ) {
-        unsigned count = 0;
-        if( SHOWREAL )
-            printf( "%p\n", pages );
+    ObjectAllocator *oa = 0;
+    unsigned wrap = 32;
+    unsigned padbytes = 2;
+    Student *pStudent2 = 0;
+    try {
+        bool newdel = false;
+        bool debug = true;
+        OAConfig::HeaderBlockInfo header( OAConfig::hbBasic );
+        unsigned alignment = 0;
+        bool checksum = true;
+        OAConfig config( newdel, 4, 1, debug, padbytes, header, alignment, checksum );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        PrintConfig( oa );
+        oa->Allocate(); // 1
+        pStudent2 = static_cast<Student *>( oa->Allocate() );
+        oa->Allocate(); // 3
+        PrintCounts( oa );
+        DumpPages( oa, wrap );
+        cout << "Number of corruptions: " << oa->ValidatePages( ValidateCallback ) << endl << endl;
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
         else
-            printf( "XXXXXXXX\n" );
-        // print column header
-        for( unsigned j = 0; j < width; j++ )
-            printf( " %2i", j );
-        printf( "\n" );
-        // "Next page" pointer in the page
-        if( SHOWREAL ) {
-            for( unsigned i = 0; i < sizeof( void * ); i++, count++ )
-                printf( " %02X", *pages++ );
-        } else {
-            for( unsigned j = 0; j < sizeof( void * ); pages++, count++, j++ )
-                printf( " %s", "XX" );
-        }
-        // Left leading alignment bytes
-        if( nm->GetConfig().Alignment_ > 1 ) {
-            // leading alignment block (if any)
-            for( unsigned j = 0; j < nm->GetConfig().LeftAlignSize_; count++, j++ ) {
-                if( count >= width ) {
-                    printf( "\n" );
-                    count = 0;
-                }
-                printf( " %02X", *pages++ );
-            }
-        }
-        // Dump each object and its associated info
-        for( unsigned int i = 0; i < nm->GetConfig().ObjectsPerPage_ ; i++ ) {
-            // inter-block alignment (not on first block)
-            if( i > 0 ) {
-                for( unsigned j = 0; j < nm->GetConfig().InterAlignSize_; count++, j++ ) {
-                    if( count >= width ) {
-                        printf( "\n" );
-                        count = 0;
-                    }
-                    printf( " %02X", *pages++ );
-                }
-            }
-            // header block bytes
-            for( unsigned j = 0; j < header_size; count++, j++ ) {
-                if( count >= width ) {
-                    printf( "\n" );
-                    count = 0;
-                }
-                printf( " %02X", *pages++ );
-            }
-            // left padding
-            for( unsigned j = 0; j < nm->GetConfig().PadBytes_; count++, j++ ) {
-                if( count >= width ) {
-                    printf( "\n" );
-                    count = 0;
-                }
-                printf( " %02X", *pages++ );
-            }
-            // possible next pointer (zero it out)
-            for( unsigned j = 0; j < sizeof( void * ); count++, pages++, j++ ) {
-                if( count >= width ) {
-                    printf( "\n" );
-                    count = 0;
-                }
-                if( SHOWREAL )
-                    printf( " %02X", *pages );
-                else
-                    printf( " %s", "XX" );
-            }
-            // remaining bytes
-            for( unsigned j = 0; j < nm->GetStats().ObjectSize_ - sizeof( void * ); count++, j++ ) {
-                if( count >= width ) {
-                    printf( "\n" );
-                    count = 0;
-                }
-                printf( " %02X", *pages++ );
-            }
-            // right pad bytes
-            for( unsigned j = 0; j < nm->GetConfig().PadBytes_; count++, j++ ) {
-                if( count >= width ) {
-                    printf( "\n" );
-                    count = 0;
-                }
-                printf( " %02X", *pages++ );
-            }
-        }
-        printf( "\n\n" );
-        pages = reinterpret_cast<const unsigned char *>( ( reinterpret_cast<const GenericObject *>( realpage ) )->Next );
-        realpage = pages;
+            cout << "Exception thrown during construction/allocation in TestHeaderChecksum."  << endl;
+        return;
+    }
+    // change the allocation number of 2, the pad bytes stay intact
+    unsigned char *p = reinterpret_cast<unsigned char *>( pStudent2 ) - padbytes - OAConfig::BASIC_HEADER_SIZE;
+    *p = 0x63;
+    unsigned count = oa->ValidatePages( ValidateCallback );
+    cout << "Number of corruptions: " << count << endl << endl;
+    try {
+        oa->Free( pStudent2 );
+        cout << "Corrupted header wasn't detected by Free." << endl;
+    } catch( const OAException& e ) {
+        if( e.code() == e.E_CORRUPTED_BLOCK )
+            cout << "Exception thrown from Free: E_CORRUPTED_BLOCK on header" << endl;
+        else
+            cout << "****** Unknown OAException thrown from Free in TestHeaderChecksum. ******" << endl;
     }
+    delete oa;
 }
 
-void DumpExternalHeaders( const ObjectAllocator *oa, const unsigned char *p )
+//****************************************************************************************************
+//****************************************************************************************************
+void OtherFreeErrorCallback( const void *, const OAException& e )
 {
-    unsigned char *page = const_cast<unsigned char *>( p );
-    unsigned padbytes = oa->GetConfig().PadBytes_;
-    size_t header_size = oa->GetConfig().HBlockInfo_.size_;
-    unsigned leftalign = oa->GetConfig().LeftAlignSize_;
-    unsigned interalign = oa->GetConfig().InterAlignSize_;
-    unsigned count = oa->GetConfig().ObjectsPerPage_;
-    size_t offset = padbytes * 2 + header_size + interalign + oa->GetStats().ObjectSize_;
-    page += sizeof( void * ); // the 'next' pointer
-    page += leftalign;      // the left alignment bytes (if any)
-    // We're now pointing at the beginning of the header block
-    MemBlockInfo *pm = reinterpret_cast<MemBlockInfo *>( *reinterpret_cast<MemBlockInfo **>( page ) );
-    cout << "  Label: " << ( pm && pm->label ? pm->label : "" ) << std::endl;
-    cout << " In use: " << ( pm ? pm->in_use : 0 ) << std::endl;
-    cout << "Alloc #: " << ( pm && pm->in_use ? pm->alloc_num : 0 ) << std::endl;
-    for( unsigned i = 1; i < count; i++ ) {
-        page += offset;
-        MemBlockInfo *pm = reinterpret_cast<MemBlockInfo *>( *reinterpret_cast<MemBlockInfo **>( page ) );
-        cout << "  Label: " << ( pm && pm->label ? pm->label : "" ) << std::endl;
-        cout << " In use: " << ( pm ? pm->in_use : 0 ) << std::endl;
-        cout << "Alloc #: " << ( pm && pm->in_use ? pm->alloc_num : 0 ) << std::endl;
+    cout << "Error from deferred Free (second callback): " << e.what() << endl;
+}
+
+void FreeStudents( ObjectAllocator *oa, Student **students, unsigned count )
+{
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( students[i] );
+}
+
+void TestDeferredFree( void )
+{
+    ObjectAllocator *oa = 0;
+    Student *students[12];
+    unsigned padbytes = 4;
+    try {
+        bool newdel = false;
+        bool debug = true;
+        OAConfig::HeaderBlockInfo header( OAConfig::hbBasic );
+        OAConfig config( newdel, 4, 3, debug, padbytes, header );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        for( unsigned i = 0; i < 12; i++ )
+            students[i] = static_cast<Student *>( oa->Allocate() );
+        PrintCounts( oa );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestDeferredFree."  << endl;
+        return;
     }
+
+    // Two threads free four blocks each, the background thread does the checks
+    oa->SetDeferredFree( true, FreeErrorCallback );
+    std::thread first( FreeStudents, oa, students, 4u );
+    std::thread second( FreeStudents, oa, students + 4, 4u );
+    first.join();
+    second.join();
+    oa->FlushDeferredFrees();
+    PrintCounts( oa );
+
+    // Errors go to the callback instead of being thrown
+    oa->Free( students[0] );
+    unsigned char *p = reinterpret_cast<unsigned char *>( students[8] ) + sizeof( Student );
+    for( unsigned i = 0; i < padbytes; i++ )
+        *p++ = 0xFF;
+    oa->Free( students[8] );
+    oa->FlushDeferredFrees();
+    PrintCounts( oa );
+    unsigned count = oa->ValidatePages( ValidateCallback );
+    cout << "Number of corruptions: " << count << endl;
+
+    // The callback can be changed while the background thread runs
+    oa->SetDeferredFree( true, OtherFreeErrorCallback );
+    oa->Free( students[1] );
+    oa->Free( students[9] );
+    oa->SetDeferredFree( false );
+    PrintCounts( oa );
+    count = oa->DumpMemoryInUse( DumpCallback2 );
+    cout << "Blocks in use: " << count << endl;
+    delete oa;
 }
 
-void DumpPagesEx( const ObjectAllocator *nm, unsigned width )
+//****************************************************************************************************
+//****************************************************************************************************
+typedef SynchronizedObjectAllocator<SpinLock> SharedAllocator;
+
+void WaitAndFree( SharedAllocator *oa, std::atomic<unsigned> *started )
 {
-    const unsigned char *pages = static_cast<const unsigned char *>( nm->GetPageList() );
-    const unsigned char *realpage = pages;
-    size_t header_size = nm->GetConfig().HBlockInfo_.size_;
-    while( pages ) {
-        unsigned count = 0;
-        if( SHOWREAL )
-            printf( "%p\n", pages );
+    started->fetch_add( 1 );
+    void *block = oa->AllocateWait();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    oa->Free( block );
+}
+
+void TestAllocateWait( void )
+{
+    SharedAllocator *oa = 0;
+    void *blocks[2];
+    try {
+        OAConfig config( false, 2, 1 );
+        oa = new SharedAllocator( sizeof( Student ), config );
+        blocks[0] = oa->Allocate();
+        blocks[1] = oa->Allocate();
+        PrintCounts( &oa->Unsynchronized() );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
         else
-            printf( "XXXXXXXX\n" );
-        // print column header
-        for( unsigned j = 0; j < width; j++ )
-            printf( " %2i", j );
-        printf( "\n" );
-        if( SHOWREAL ) {
-            for( unsigned i = 0; i < sizeof( void * ); i++, count++ )
-                printf( " %02X", *pages++ );
-        } else {
-            for( unsigned j = 0; j < sizeof( void * ); pages++, count++, j++ )
-                printf( " %s", "XX" );
+            cout << "Exception thrown during construction/allocation in TestAllocateWait."  << endl;
+        return;
+    }
+
+    // Nobody frees anything
+    try {
+        oa->AllocateFor( std::chrono::milliseconds( 20 ) );
+        cout << "AllocateFor didn't time out." << endl;
+    } catch( const OAException& e ) {
+        if( e.code() == e.E_NO_PAGES )
+            cout << "Exception thrown from AllocateFor: E_NO_PAGES" << endl;
+        else
+            cout << "****** Unknown OAException thrown from AllocateFor in TestAllocateWait. ******" << endl;
+    }
+
+    // Four threads wait for the two blocks, each one gives its block back after a while
+    std::atomic<unsigned> started( 0 );
+    std::thread waiters[4];
+    for( unsigned i = 0; i < 4; i++ )
+        waiters[i] = std::thread( WaitAndFree, oa, &started );
+    while( started.load() < 4 )
+        std::this_thread::yield();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 20 ) );
+    oa->Free( blocks[0] );
+    oa->Free( blocks[1] );
+    for( unsigned i = 0; i < 4; i++ )
+        waiters[i].join();
+    PrintCounts( &oa->Unsynchronized() );
+
+    // Room shows up in time
+    blocks[0] = oa->Allocate();
+    blocks[1] = oa->Allocate();
+    std::thread freer( &SharedAllocator::Free, oa, blocks[0] );
+    try {
+        void *block = oa->AllocateFor( std::chrono::milliseconds( 10000 ) );
+        cout << "AllocateFor got the freed block: " << ( block == blocks[0] ? "yes" : "no" ) << endl;
+        oa->Free( block );
+    } catch( const OAException& ) {
+        cout << "AllocateFor timed out although a block was freed." << endl;
+    }
+    freer.join();
+    oa->Free( blocks[1] );
+    PrintCounts( &oa->Unsynchronized() );
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+unsigned CountFound( void **blocks, unsigned count, const ObjectAllocator *oa )
+{
+    unsigned found = 0;
+    for( unsigned i = 0; i < count; i++ )
+        if( PageMap::Find( blocks[i] ) == oa )
+            found++;
+    return found;
+}
+
+void TestPageMap( void )
+{
+    ObjectAllocator *students = 0, *employees = 0, *big = 0;
+    const unsigned count = 16;
+    void *studentBlocks[count], *employeeBlocks[count], *bigBlocks[2];
+    try {
+        // Small pages from new[], pages of both allocators end up in the same chunks
+        OAConfig config( false, 2, 0 );
+        students = new ObjectAllocator( sizeof( Student ), config );
+        employees = new ObjectAllocator( sizeof( Employee ), config );
+        for( unsigned i = 0; i < count; i++ ) {
+            studentBlocks[i] = students->Allocate();
+            employeeBlocks[i] = employees->Allocate();
+        }
+        // A page covering whole chunks
+        OAConfig bigConfig( false, 1024, 0 );
+        big = new ObjectAllocator( sizeof( Student ), bigConfig );
+        bigBlocks[0] = big->Allocate();
+        bigBlocks[1] = big->Allocate();
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestPageMap."  << endl;
+        return;
+    }
+
+    cout << "Students found: " << CountFound( studentBlocks, count, students ) << endl;
+    cout << "Employees found: " << CountFound( employeeBlocks, count, employees ) << endl;
+    cout << "Big blocks found: " << CountFound( bigBlocks, 2, big ) << endl;
+
+    // Each block goes back to its own allocator
+    for( unsigned i = 0; i < count; i++ ) {
+        oa::Free( studentBlocks[i] );
+        oa::Free( employeeBlocks[i] );
+    }
+    oa::Free( bigBlocks[0] );
+    PrintCounts( students );
+    PrintCounts( employees );
+    PrintCounts( big );
+
+    // Released pages and destroyed allocators are forgotten, shared chunks included
+    cout << "Empty pages freed: " << students->FreeEmptyPages() << endl;
+    cout << "Students no longer found: " << CountFound( studentBlocks, count, 0 ) << endl;
+    delete employees;
+    cout << "Employees no longer found: " << CountFound( employeeBlocks, count, 0 ) << endl;
+    try {
+        oa::Free( employeeBlocks[0] );
+        cout << "Freed a block of a destroyed allocator." << endl;
+    } catch( const OAException& e ) {
+        if( e.code() == e.E_BAD_ADDRESS )
+            cout << "Exception thrown from Free: E_BAD_ADDRESS" << endl;
+        else
+            cout << "****** Unknown OAException thrown from Free in TestPageMap. ******" << endl;
+    }
+    Student local;
+    try {
+        oa::Free( &local );
+        cout << "Freed a block that isn't on any page." << endl;
+    } catch( const OAException& e ) {
+        if( e.code() == e.E_BAD_ADDRESS )
+            cout << "Exception thrown from Free: E_BAD_ADDRESS" << endl;
+        else
+            cout << "****** Unknown OAException thrown from Free in TestPageMap. ******" << endl;
+    }
+    cout << "Big blocks found: " << CountFound( bigBlocks, 2, big ) << endl;
+    oa::Free( bigBlocks[1] );
+    PrintCounts( big );
+    delete students;
+    delete big;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+struct PooledStudent : public PooledObject<PooledStudent> {
+    Student student;
+};
+
+struct alignas( 32 ) Vector4 : public PooledObject<Vector4, 5> {
+    double x, y, z, w;
+    char tag;
+};
+
+struct PooledFailure : public PooledObject<PooledFailure> {
+    explicit PooledFailure( bool fail ) : value( 0 )
+    {
+        if( fail )
+            throw std::runtime_error( "PooledFailure" );
+    }
+    int value;
+};
+
+template <typename T>
+void AllocatePooled( const char *name )
+{
+    const unsigned count = 20;
+    T *objects[count];
+    unsigned aligned = 0;
+    for( unsigned i = 0; i < count; i++ ) {
+        objects[i] = new T;
+        if( reinterpret_cast<size_t>( objects[i] ) % alignof( T ) == 0 )
+            aligned++;
+    }
+    cout << name << " (align " << alignof( T ) << ") aligned: " << aligned << " of " << count << endl;
+    PrintCounts( &T::Pool().Pool().Unsynchronized() );
+    for( unsigned i = 0; i < count; i++ )
+        delete objects[i];
+    T::Pool().FlushThreadCache();
+    PrintCounts( &T::Pool().Pool().Unsynchronized() );
+}
+
+void TestPooledObject( void )
+{
+    try {
+        AllocatePooled<PooledStudent>( "PooledStudent" );
+        AllocatePooled<Vector4>( "Vector4" );
+
+        // The nothrow and placement forms aren't hidden by the class operator new
+        PooledStudent *student = new( std::nothrow ) PooledStudent;
+        cout << "Nothrow new from the pool: " << ( PageMap::Find( student ) == &PooledStudent::Pool().Pool().Unsynchronized() ? "yes" : "no" ) << endl;
+        delete student;
+        alignas( PooledStudent ) unsigned char buffer[sizeof( PooledStudent )];
+        student = new( buffer ) PooledStudent;
+        cout << "Placement new in the buffer: " << ( static_cast<void *>( student ) == buffer ? "yes" : "no" ) << endl;
+        student->~PooledStudent();
+        PooledStudent::Pool().FlushThreadCache();
+        PrintCounts( &PooledStudent::Pool().Pool().Unsynchronized() );
+
+        // A constructor that throws gives the block back through the nothrow delete
+        try {
+            new( std::nothrow ) PooledFailure( true );
+        } catch( const std::runtime_error& ) {
+            cout << "Constructor threw after new (std::nothrow)." << endl;
+        }
+        PooledFailure *working = new( std::nothrow ) PooledFailure( false );
+        delete working;
+        PooledFailure::Pool().FlushThreadCache();
+        PrintCounts( &PooledFailure::Pool().Pool().Unsynchronized() );
+    } catch( const std::bad_alloc& ) {
+        cout << "Exception thrown during allocation in TestPooledObject."  << endl;
+    }
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void PrintCacheCounts( ThreadCachedAllocator *tca )
+{
+    cout << "Cache size: " << tca->CacheSize() << ", ";
+    PrintCounts( &tca->Pool().Unsynchronized() );
+}
+
+void CacheAndWait( ThreadCachedAllocator *tca, std::atomic<int> *state )
+{
+    void *blocks[8];
+    for( unsigned i = 0; i < 8; i++ )
+        blocks[i] = tca->Allocate();
+    for( unsigned i = 0; i < 8; i++ )
+        tca->Free( blocks[i] );
+    // Exits with the blocks still in its cache, after the allocator is gone
+    state->store( 1 );
+    while( state->load() != 2 )
+        std::this_thread::yield();
+}
+
+void TestThreadCache( void )
+{
+    ThreadCachedAllocator *tca = 0;
+    const unsigned count = 10;
+    void *blocks[count];
+    try {
+        OAConfig config( false, 16, 0 );
+        tca = new ThreadCachedAllocator( sizeof( Student ), config );
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = tca->Allocate();
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestThreadCache."  << endl;
+        delete tca;
+        return;
+    }
+
+    // One batch came over, the rest of it is in this thread's cache
+    PrintCacheCounts( tca );
+    for( unsigned i = 0; i < count; i++ )
+        tca->Free( blocks[i] );
+    PrintCacheCounts( tca );
+    tca->FlushThreadCache();
+    PrintCacheCounts( tca );
+
+    // A small cache refills in small batches and gives half back when it overflows
+    tca->SetCacheSize( 4 );
+    for( unsigned i = 0; i < count; i++ )
+        blocks[i] = tca->Allocate();
+    PrintCacheCounts( tca );
+    for( unsigned i = 0; i < count; i++ )
+        tca->Free( blocks[i] );
+    PrintCacheCounts( tca );
+    tca->SetCacheSize( 0 );
+    tca->FlushThreadCache();
+    PrintCacheCounts( tca );
+
+    // Destroyed while this thread and another one have blocks cached
+    tca->SetCacheSize( ThreadCachedAllocator::CACHE_SIZE );
+    std::atomic<int> state( 0 );
+    std::thread other( CacheAndWait, tca, &state );
+    while( state.load() != 1 )
+        std::this_thread::yield();
+    blocks[0] = tca->Allocate();
+    tca->Free( blocks[0] );
+    PrintCacheCounts( tca );
+    delete tca;
+    state.store( 2 );
+    other.join();
+    cout << "Thread exited after the allocator was destroyed." << endl;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+struct FramePromise : public PooledFramePromise {
+    char frame[200];
+};
+
+void TestCoroutineFrames( void )
+{
+    // Frames are rounded up to a multiple of 16, each size class has its own pool
+    const size_t sizes[] = {1, 16, 17, 100, CoroutineFrameAllocator::MAX_POOLED_SIZE, CoroutineFrameAllocator::MAX_POOLED_SIZE + 1};
+    const unsigned count = sizeof( sizes ) / sizeof( *sizes );
+    void *frames[count];
+    try {
+        for( unsigned i = 0; i < count; i++ ) {
+            ThreadCachedAllocator *pool = CoroutineFrameAllocator::Pool( sizes[i] );
+            frames[i] = CoroutineFrameAllocator::Allocate( sizes[i] );
+            cout << "Frame of " << sizes[i] << " bytes: ";
+            if( pool )
+                cout << "pool of " << pool->Pool().Unsynchronized().GetStats().ObjectSize_ << " bytes";
+            else
+                cout << "new/delete";
+            cout << ", aligned: " << ( reinterpret_cast<size_t>( frames[i] ) % CoroutineFrameAllocator::SIZE_CLASS_STEP == 0 ? "yes" : "no" );
+            cout << ", in a pool: " << ( PageMap::Find( frames[i] ) ? "yes" : "no" ) << endl;
+        }
+    } catch( const std::bad_alloc& ) {
+        cout << "Exception thrown during allocation in TestCoroutineFrames."  << endl;
+        return;
+    }
+    cout << "Same pool for 1 and 16 bytes: " << ( CoroutineFrameAllocator::Pool( 1 ) == CoroutineFrameAllocator::Pool( 16 ) ? "yes" : "no" ) << endl;
+    for( unsigned i = 0; i < count; i++ )
+        CoroutineFrameAllocator::Free( frames[i], sizes[i] );
+
+    // Promise types get their frames from the pool through the sized operator delete
+    FramePromise *promises[4];
+    for( unsigned i = 0; i < 4; i++ )
+        promises[i] = new FramePromise;
+    ThreadCachedAllocator *pool = CoroutineFrameAllocator::Pool( sizeof( FramePromise ) );
+    cout << "Promise frames from the pool: " << ( PageMap::Find( promises[0] ) == &pool->Pool().Unsynchronized() ? "yes" : "no" ) << endl;
+    for( unsigned i = 0; i < 4; i++ )
+        delete promises[i];
+    pool->FlushThreadCache();
+    PrintCounts( &pool->Pool().Unsynchronized() );
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void WaitForBuffer( IOBufferPool *pool, std::atomic<int> *state )
+{
+    state->store( 1 );
+    try {
+        // Not woken up, it would only look again when the time is up
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        void *data = pool->Buffers().AllocateFor( std::chrono::milliseconds( 2000 ) );
+        pool->Buffers().Free( data );
+        state->store( std::chrono::steady_clock::now() - start < std::chrono::milliseconds( 1000 ) ? 2 : 3 );
+    } catch( const OAException& ) {
+        state->store( 3 );
+    }
+}
+
+void TestIOBufferPool( void )
+{
+    IOBufferPool *pool = 0;
+    const unsigned count = 4;
+    IOBuffer *buffers[count];
+    try {
+        pool = new IOBufferPool( 5000, count, 1 );
+        pool->AcquireBatch( buffers, count );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestIOBufferPool."  << endl;
+        delete pool;
+        return;
+    }
+
+    unsigned aligned = 0;
+    for( unsigned i = 0; i < count; i++ )
+        if( reinterpret_cast<size_t>( buffers[i]->Data ) % IOBufferPool::IO_ALIGNMENT == 0 && buffers[i]->Capacity == pool->BufferSize() )
+            aligned++;
+    cout << "Buffer size: " << pool->BufferSize() << ", page aligned: " << aligned << " of " << count << endl;
+#ifndef _WIN32
+    struct iovec vectors[count];
+    buffers[1]->Length = 100;
+    IOBufferPool::FillReadIovec( buffers, vectors, count );
+    cout << "Read vector: " << vectors[1].iov_len << " bytes";
+    IOBufferPool::FillWriteIovec( buffers, vectors, count );
+    cout << ", write vector: " << vectors[1].iov_len << " bytes" << endl;
+#endif
+    try {
+        pool->Acquire();
+        cout << "Acquired past max pages." << endl;
+    } catch( const OAException& e ) {
+        if( e.code() == e.E_NO_PAGES )
+            cout << "Exception thrown from Acquire: E_NO_PAGES" << endl;
+        else
+            cout << "****** Unknown OAException thrown from Acquire in TestIOBufferPool. ******" << endl;
+    }
+
+    // The buffer goes back when its last owner lets go
+    IOBufferPool::Retain( buffers[0] );
+    IOBufferPool::Release( buffers[0] );
+    cout << "Buffers in use after one of two releases: " << pool->Buffers().GetStats().ObjectsInUse_ << endl;
+    IOBufferPool::Release( buffers[0] );
+    cout << "Buffers in use after both: " << pool->Buffers().GetStats().ObjectsInUse_ << endl;
+
+    // All of them or none
+    IOBuffer *more[2];
+    try {
+        pool->AcquireBatch( more, 2 );
+        cout << "Acquired past max pages." << endl;
+    } catch( const OAException& ) {
+        cout << "Batch failed, buffers in use: " << pool->Buffers().GetStats().ObjectsInUse_ << endl;
+    }
+    pool->AcquireBatch( more, 1 );
+
+    // A full pool wakes a waiting allocation up when a batch is released
+    std::atomic<int> state( 0 );
+    std::thread waiter( WaitForBuffer, pool, &state );
+    while( state.load() == 0 )
+        std::this_thread::yield();
+    std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+    buffers[0] = more[0];
+    pool->ReleaseBatch( buffers, count );
+    waiter.join();
+    cout << "Waiting allocation " << ( state.load() == 2 ? "woken up" : "timed out" ) << endl;
+    PrintCounts( &pool->Buffers().Unsynchronized() );
+    delete pool;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void PrintControl( const char *key, const char *newValue = 0 )
+{
+    std::string value;
+    bool isDone = AllocatorControl::Control( key, newValue ? 0 : &value, newValue );
+    cout << key;
+    if( newValue )
+        cout << " = " << newValue;
+    if( !isDone )
+        cout << ": rejected" << endl;
+    else if( newValue )
+        cout << ": written" << endl;
+    else
+        cout << ": " << value << endl;
+}
+
+void TestAllocatorControl( void )
+{
+    // Overrides are read the first time a pool is configured, the variable after the file
+    const char *fileName = "oa_config_test";
+    {
+        std::ofstream file( fileName );
+        file << "# tuning for the test" << endl;
+        file << "control.objects_per_page = 8" << endl;
+        file << "control.max_pages=2" << endl;
+        file << "*.pad_bytes=2" << endl;
+    }
+    const char *variable = "control.max_pages=5; control.debug=1; control.bogus=1; control.alignment=-4; no field";
+#ifdef _WIN32
+    _putenv_s( "OA_CONFIG_FILE", fileName );
+    _putenv_s( "OA_CONFIG", variable );
+#else
+    setenv( "OA_CONFIG_FILE", fileName, 1 );
+    setenv( "OA_CONFIG", variable, 1 );
+#endif
+    OAConfig config = AllocatorControl::Configure( "control", OAConfig( false, 4, 0, false, 0 ) );
+    std::remove( fileName );
+    cout << "ObjectsPerPage = " << config.ObjectsPerPage_ << ", MaxPages = " << config.MaxPages_;
+    cout << ", Pad bytes = " << config.PadBytes_ << ", Debug = " << config.DebugOn_ << ", Alignment = " << config.Alignment_ << endl;
+    config = AllocatorControl::Configure( "other", OAConfig() );
+    cout << "Other pool pad bytes = " << config.PadBytes_ << ", MaxPages = " << config.MaxPages_ << endl;
+
+    ObjectAllocator *oa = 0;
+    void *blocks[10];
+    try {
+        oa = new ObjectAllocator( sizeof( Student ), AllocatorControl::Configure( "control", OAConfig( false, 4, 0, false, 0 ) ) );
+        for( unsigned i = 0; i < 10; i++ )
+            blocks[i] = oa->Allocate();
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestAllocatorControl."  << endl;
+        delete oa;
+        return;
+    }
+
+    AllocatorControl::Register( "control", *oa );
+    PrintControl( "pools" );
+    PrintControl( "pool.control.config.objects_per_page" );
+    PrintControl( "pool.control.config.pad_bytes" );
+    PrintControl( "pool.control.stats.pages_in_use" );
+    PrintControl( "pool.control.stats.objects_in_use" );
+    PrintControl( "pool.control.max_pages" );
+    PrintControl( "pool.control.max_pages", "1" );
+    PrintControl( "pool.control.max_pages" );
+    for( unsigned i = 0; i < 10; i++ )
+        oa->Free( blocks[i] );
+    PrintControl( "pool.control.validate" );
+    PrintControl( "pool.control.trim" );
+    PrintControl( "pool.control.stats.pages_in_use" );
+
+    // Unknown keys, read only keys and bad values are rejected
+    PrintControl( "pool.control.unknown" );
+    PrintControl( "pool.control.stats.unknown" );
+    PrintControl( "pool.missing.max_pages" );
+    PrintControl( "control.max_pages" );
+    PrintControl( "pool.control.stats.pages_in_use", "4" );
+    PrintControl( "pool.control.max_pages", "many" );
+    PrintControl( "pool.control.max_pages", "-1" );
+    PrintControl( "pool.control.cache_size" );
+    PrintControl( "pools", "control" );
+    AllocatorControl::Unregister( "control" );
+    PrintControl( "pool.control.max_pages" );
+    PrintControl( "pools" );
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+unsigned CountFilled( unsigned char **blocks, unsigned count, size_t size )
+{
+    unsigned filled = 0;
+    for( unsigned i = 0; i < count; i++ ) {
+        size_t j = 0;
+        while( j < size && blocks[i][j] == static_cast<unsigned char>( i + 1 ) )
+            j++;
+        if( j == size )
+            filled++;
+    }
+    return filled;
+}
+
+void TestColdPages( void )
+{
+    ObjectAllocator *oa = 0;
+    const unsigned count = 12;
+    const size_t size = 4096;
+    unsigned char *blocks[count];
+    try {
+        OAConfig config( false, 4, 0 );
+        oa = new ObjectAllocator( size, config );
+        oa->SetPageUseTracking( true );
+        for( unsigned i = 0; i < count; i++ ) {
+            blocks[i] = static_cast<unsigned char *>( oa->Allocate() );
+            memset( blocks[i], static_cast<int>( i + 1 ), size );
+        }
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestColdPages."  << endl;
+        delete oa;
+        return;
+    }
+    PrintCounts( oa );
+    cout << "Pages advised right away: " << oa->AdviseColdPages( 2 ) << endl;
+
+    // The page of the first block is used again, the other two stay idle
+    oa->Tick();
+    oa->Tick();
+    oa->Free( blocks[0] );
+    blocks[0] = static_cast<unsigned char *>( oa->Allocate() );
+    memset( blocks[0], 1, size );
+    cout << "Pages advised after 2 ticks: " << oa->AdviseColdPages( 2 ) << endl;
+    cout << "Pages advised again: " << oa->AdviseColdPages( 2 ) << endl;
+    oa->Tick();
+    cout << "Pages advised after 1 more tick: " << oa->AdviseColdPages( 1 ) << endl;
+
+    // The objects stay where they were, advised or not
+    cout << "Blocks still filled: " << CountFilled( blocks, count, size ) << endl;
+
+    // Empty pages are left for FreeEmptyPages
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( blocks[i] );
+    oa->Tick();
+    oa->Tick();
+    cout << "Empty pages advised: " << oa->AdviseColdPages( 1 ) << endl;
+    PrintCounts( oa );
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+bool HasSoftDirty( void )
+{
+#ifdef __linux__
+    // The write to clear_refs succeeds on kernels without soft-dirty too, so write a page
+    // after it and see if that page comes back dirty
+    static char buffer[3 * 65536];
+    const size_t osPageSize = static_cast<size_t>( sysconf( _SC_PAGESIZE ) );
+    size_t page = ( reinterpret_cast<size_t>( buffer ) + osPageSize - 1 ) / osPageSize;
+    FILE *clearRefs = fopen( "/proc/self/clear_refs", "w" );
+    if( !clearRefs )
+        return false;
+    fputs( "4", clearRefs );
+    if( fclose( clearRefs ) != 0 )
+        return false;
+    *reinterpret_cast<volatile char *>( page * osPageSize ) = 1;
+
+    FILE *pagemap = fopen( "/proc/self/pagemap", "rb" );
+    if( !pagemap )
+        return false;
+    unsigned long long entry = 0;
+    bool isRead = fseek( pagemap, static_cast<long>( page * sizeof( entry ) ), SEEK_SET ) == 0
+        && fread( &entry, sizeof( entry ), 1, pagemap ) == 1;
+    fclose( pagemap );
+    return isRead && ( entry & ( 1ULL << 55 ) ) != 0;
+#else
+    return false;
+#endif
+}
+
+void TestDirtyPages( void )
+{
+    ObjectAllocator *oa = 0;
+    const unsigned count = 6;
+    const size_t size = 4096;
+    unsigned char *blocks[count];
+    // Checked before the pool is made, the check clears the soft-dirty bits itself
+    bool hasSoftDirty = HasSoftDirty();
+    try {
+        // Objects as big as an OS page, so the pad written below sits on an OS page
+        // that only holds pool memory
+        OAConfig config( false, 2, 0, true, 4 );
+        oa = new ObjectAllocator( size, config );
+        for( unsigned i = 0; i < count; i++ ) {
+            blocks[i] = static_cast<unsigned char *>( oa->Allocate() );
+            memset( blocks[i], static_cast<int>( i + 1 ), size );
+        }
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestDirtyPages."  << endl;
+        delete oa;
+        return;
+    }
+    PrintCounts( oa );
+    unsigned corruptions = oa->ValidateDirtyPages( ValidateCallback );
+    cout << "Corruptions on the first pass: " << corruptions << endl;
+
+    // Write one byte past the third block, into its right pad
+    blocks[2][size] = 0xFF;
+    corruptions = oa->ValidateDirtyPages( ValidateCallback );
+    cout << "Corruptions after writing past a block: " << corruptions << endl;
+
+    // Nothing was written since, so the page with the bad pad isn't looked at again until
+    // the block is written to. Without soft-dirty bits every call is a full ValidatePages,
+    // so that part is skipped. Only a failure goes to cout, the expected output is the same
+    // on kernels with and without soft-dirty.
+    if( hasSoftDirty ) {
+        unsigned clean = oa->ValidateDirtyPages( DumpCallback2 );
+        blocks[2][0] = 0;
+        unsigned rewritten = oa->ValidateDirtyPages( DumpCallback2 );
+        if( clean != 0 || rewritten != 1 )
+            cout << "Clean page check failed: " << clean << " corruptions with no writes, "
+                 << rewritten << " after writing into the block" << endl;
+    } else
+        std::cerr << "TestDirtyPages SKIPPED: soft-dirty bits unavailable, clean page check not run" << endl;
+
+    // Put the pad back so the blocks can be freed
+    blocks[2][size] = ObjectAllocator::PAD_PATTERN;
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( blocks[i] );
+    PrintCounts( oa );
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+const void *ReportedBlocks[16];
+unsigned ReportedCount = 0;
+bool ReportedOffThread = false;
+std::thread::id ValidatingThread;
+
+void RecordCallback( const void *block, size_t )
+{
+    if( std::this_thread::get_id() != ValidatingThread )
+        ReportedOffThread = true;
+    if( ReportedCount < sizeof( ReportedBlocks ) / sizeof( *ReportedBlocks ) )
+        ReportedBlocks[ReportedCount] = block;
+    ReportedCount++;
+}
+
+void TestValidateThreads( void )
+{
+    ObjectAllocator *oa = 0;
+    const unsigned count = 40;
+    unsigned char *blocks[count];
+    try {
+        OAConfig config( false, 4, 0, true, 4 );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = static_cast<unsigned char *>( oa->Allocate() );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestValidateThreads."  << endl;
+        delete oa;
+        return;
+    }
+    PrintCounts( oa );
+
+    // Spread over the first, a middle and the last pages, before and after the blocks
+    const unsigned bad[] = { 1, 2, 17, 26, 39 };
+    const unsigned badCount = sizeof( bad ) / sizeof( *bad );
+    for( unsigned i = 0; i < badCount; i++ ) {
+        if( i % 2 )
+            blocks[bad[i]][-1] = 0;
+        else
+            blocks[bad[i]][sizeof( Student )] = 0;
+    }
+
+    ValidatingThread = std::this_thread::get_id();
+    const void *expected[sizeof( ReportedBlocks ) / sizeof( *ReportedBlocks )];
+    unsigned expectedCount = oa->ValidatePages( RecordCallback );
+    memcpy( expected, ReportedBlocks, sizeof( expected ) );
+    cout << "Corruptions on one thread: " << expectedCount << endl;
+
+    // More threads than pages are cut down to one per page
+    const unsigned threadCounts[] = { 2, 3, 4, 10, 64 };
+    for( unsigned i = 0; i < sizeof( threadCounts ) / sizeof( *threadCounts ); i++ ) {
+        ReportedCount = 0;
+        ReportedOffThread = false;
+        unsigned corruptions = oa->ValidatePages( RecordCallback, threadCounts[i] );
+        bool sameOrder = corruptions == expectedCount && ReportedCount == expectedCount
+            && memcmp( expected, ReportedBlocks, expectedCount * sizeof( *expected ) ) == 0;
+        cout << "Corruptions on " << threadCounts[i] << " threads: " << corruptions
+             << ", same blocks in the same order: " << ( sameOrder ? "yes" : "no" )
+             << ", callbacks on the calling thread: " << ( ReportedOffThread ? "no" : "yes" ) << endl;
+    }
+
+    // Put the pads back so the blocks can be freed
+    for( unsigned i = 0; i < badCount; i++ ) {
+        if( i % 2 )
+            blocks[bad[i]][-1] = ObjectAllocator::PAD_PATTERN;
+        else
+            blocks[bad[i]][sizeof( Student )] = ObjectAllocator::PAD_PATTERN;
+    }
+    cout << "Corruptions after the fix on 4 threads: " << oa->ValidatePages( RecordCallback, 4 ) << endl;
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( blocks[i] );
+    PrintCounts( oa );
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+const unsigned CONTENTION_THREADS = 4;
+const unsigned CONTENTION_ROUNDS = 500;
+const unsigned CONTENTION_BLOCKS = 8;
+const size_t CONTENTION_SIZE = 32;
+
+// Holds a thread back until all the others have started, so they really run at the same time
+void WaitForAll( std::atomic<unsigned> *waiting )
+{
+    ( *waiting )--;
+    while( waiting->load() )
+        std::this_thread::yield();
+}
+
+// Every thread marks its blocks with its own byte, a block handed to two threads at once
+// gets the other thread's byte written over it
+template <typename LockPolicy>
+void AllocateMarkAndFree( SynchronizedObjectAllocator<LockPolicy> *oa, unsigned char mark, unsigned rounds,
+                          std::atomic<unsigned> *overwritten, std::atomic<unsigned> *waiting )
+{
+    WaitForAll( waiting );
+    unsigned char *blocks[CONTENTION_BLOCKS];
+    for( unsigned round = 0; round < rounds; round++ ) {
+        for( unsigned i = 0; i < CONTENTION_BLOCKS; i++ ) {
+            blocks[i] = static_cast<unsigned char *>( oa->Allocate() );
+            memset( blocks[i], mark, CONTENTION_SIZE );
+        }
+        std::this_thread::yield();
+        for( unsigned i = 0; i < CONTENTION_BLOCKS; i++ ) {
+            for( size_t j = 0; j < CONTENTION_SIZE; j++ ) {
+                if( blocks[i][j] != mark ) {
+                    ( *overwritten )++;
+                    break;
+                }
+            }
+            oa->Free( blocks[i] );
+        }
+    }
+}
+
+template <typename LockPolicy>
+void CountUnderLock( LockPolicy *lock, unsigned *counter, unsigned increments, std::atomic<unsigned> *waiting )
+{
+    WaitForAll( waiting );
+    for( unsigned i = 0; i < increments; i++ ) {
+        std::lock_guard<LockPolicy> guard( *lock );
+        // Give the others a chance to get in between the read and the write, even on one core
+        unsigned value = *counter;
+        std::this_thread::yield();
+        *counter = value + 1;
+    }
+}
+
+template <typename LockPolicy>
+void RunContention( const char *name, unsigned threadCount )
+{
+    typedef SynchronizedObjectAllocator<LockPolicy> Allocator;
+    Allocator *oa = 0;
+    try {
+        // Small pages, so the threads also race to grow the pool
+        OAConfig config( false, 4, 0 );
+        oa = new Allocator( CONTENTION_SIZE, config );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction in TestLockPolicies."  << endl;
+        return;
+    }
+
+    std::atomic<unsigned> overwritten( 0 );
+    std::atomic<unsigned> waiting( threadCount );
+    std::thread threads[CONTENTION_THREADS];
+    for( unsigned i = 1; i < threadCount; i++ )
+        threads[i] = std::thread( AllocateMarkAndFree<LockPolicy>, oa, static_cast<unsigned char>( i + 1 ),
+                                  CONTENTION_ROUNDS, &overwritten, &waiting );
+    AllocateMarkAndFree( oa, 1, CONTENTION_ROUNDS, &overwritten, &waiting );
+    for( unsigned i = 1; i < threadCount; i++ )
+        threads[i].join();
+
+    OAStats stats = oa->GetStats();
+    cout << name << " on " << threadCount << ( threadCount == 1 ? " thread" : " threads" )
+         << ": Allocs: " << stats.Allocations_ << ", Frees: " << stats.Deallocations_
+         << ", Objects in use: " << stats.ObjectsInUse_
+         << ", Most objects within limit: " << ( stats.MostObjects_ <= threadCount * CONTENTION_BLOCKS ? "yes" : "no" )
+         << ", Blocks handed out twice: " << overwritten.load() << endl;
+    delete oa;
+
+    // The lock on its own, a lost update shows up as a short count
+    if( threadCount > 1 ) {
+        LockPolicy lock;
+        unsigned counter = 0;
+        const unsigned increments = 500;
+        waiting = threadCount;
+        for( unsigned i = 1; i < threadCount; i++ )
+            threads[i] = std::thread( CountUnderLock<LockPolicy>, &lock, &counter, increments, &waiting );
+        CountUnderLock( &lock, &counter, increments, &waiting );
+        for( unsigned i = 1; i < threadCount; i++ )
+            threads[i].join();
+        cout << name << " counter: " << counter << " of " << threadCount * increments << endl;
+    }
+}
+
+void TestLockPolicies( void )
+{
+    // NoLock doesn't exclude anything, it's only for pools used by one thread
+    RunContention<NoLock>( "NoLock", 1 );
+    RunContention<SpinLock>( "SpinLock", CONTENTION_THREADS );
+    RunContention<TicketLock>( "TicketLock", CONTENTION_THREADS );
+    RunContention<MutexLock>( "MutexLock", CONTENTION_THREADS );
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void PrintPageHeap( const char *what )
+{
+    cout << what << ": Footprint: " << PageHeap::Footprint() / 1024 << " KiB, In use: "
+         << PageHeap::BytesInUse() / 1024 << " KiB" << endl;
+}
+
+void TestPageHeap( void )
+{
+    const size_t minBlock = PageHeap::MIN_BLOCK_SIZE;
+    unsigned char *first = 0, *second = 0, *third = 0, *whole = 0;
+    try {
+        // The first block of a new arena is its base, offsets from it show the splits
+        first = static_cast<unsigned char *>( PageHeap::Allocate( minBlock ) );
+        second = static_cast<unsigned char *>( PageHeap::Allocate( minBlock ) );
+        third = static_cast<unsigned char *>( PageHeap::Allocate( minBlock + 1 ) );
+    } catch( const std::bad_alloc& ) {
+        cout << "Exception thrown during allocation in TestPageHeap."  << endl;
+        return;
+    }
+    PrintPageHeap( "After 4 KiB, 4 KiB and 4 KiB + 1" );
+    cout << "Second block is the buddy of the first: " << ( static_cast<size_t>( second - first ) == minBlock ? "yes" : "no" ) << endl;
+    cout << "Third block offset: " << ( third - first ) / 1024 << " KiB, on an 8 KiB boundary: "
+         << ( ( third - first ) % ( 2 * minBlock ) == 0 ? "yes" : "no" ) << endl;
+
+    // Freed buddies merge back into the whole arena, so it can be handed out in one piece
+    PageHeap::Free( second, minBlock );
+    PageHeap::Free( third, minBlock + 1 );
+    PageHeap::Free( first, minBlock );
+    PrintPageHeap( "After freeing them" );
+    whole = static_cast<unsigned char *>( PageHeap::Allocate( PageHeap::MAX_BLOCK_SIZE ) );
+    cout << "Whole arena at the first block: " << ( whole == first ? "yes" : "no" ) << endl;
+    PrintPageHeap( "After a 4 MiB block" );
+
+    // A second arena is kept when it becomes free, the first goes back to the system after it
+    first = static_cast<unsigned char *>( PageHeap::Allocate( minBlock ) );
+    PrintPageHeap( "After another 4 KiB" );
+    PageHeap::Free( first, minBlock );
+    PrintPageHeap( "After freeing the 4 KiB" );
+    PageHeap::Free( whole, PageHeap::MAX_BLOCK_SIZE );
+    PrintPageHeap( "After freeing the 4 MiB" );
+
+    // Pages one pool gives back are used by a pool with another page size
+    ObjectAllocator *big = 0, *small = 0;
+    const unsigned count = 320;
+    void *blocks[count];
+    try {
+        // 1 MiB objects on 2 MiB pages, two of them fill the arena that was kept
+        OAConfig bigConfig( false, 1, 0 );
+        bigConfig.UsePageHeap_ = true;
+        big = new ObjectAllocator( 1024 * 1024, bigConfig );
+        blocks[0] = big->Allocate();
+        blocks[1] = big->Allocate();
+        PrintPageHeap( "After 2 pages of the big pool" );
+        big->Free( blocks[0] );
+        big->Free( blocks[1] );
+        cout << "Pages freed by the big pool: " << big->FreeEmptyPages() << endl;
+        PrintPageHeap( "After freeing them" );
+
+        // 40 objects of 100 bytes on 4 KiB pages
+        OAConfig smallConfig( false, 40, 0 );
+        smallConfig.UsePageHeap_ = true;
+        small = new ObjectAllocator( 100, smallConfig );
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = small->Allocate();
+        PrintPageHeap( "After 8 pages of the small pool" );
+        for( unsigned i = 0; i < count; i++ )
+            small->Free( blocks[i] );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestPageHeap."  << endl;
+    }
+    delete big;
+    delete small;
+    PrintPageHeap( "After deleting the pools" );
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void PrintPageBytes( const char *what, size_t objectSize, const OAConfig& config )
+{
+    ObjectAllocator *oa = 0, *oneMore = 0;
+    try {
+        oa = new ObjectAllocator( objectSize, config );
+        // The same layout with one more block per page must go past the target
+        OAConfig moreConfig = oa->GetConfig();
+        moreConfig.PageBytes_ = 0;
+        moreConfig.ObjectsPerPage_++;
+        oneMore = new ObjectAllocator( objectSize, moreConfig );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else if( e.code() == OAException::E_NO_PAGES )
+            cout << what << ": E_NO_PAGES" << endl;
+        else
+            cout << "Exception thrown during construction in TestPageBytes."  << endl;
+        delete oa;
+        return;
+    }
+    OAStats stats = oa->GetStats();
+    cout << what << ": Objects per page: " << oa->GetConfig().ObjectsPerPage_ << ", Page size: " << stats.PageSize_
+         << ", Waste: " << stats.PageWaste_ << ", Adds up: " << ( stats.PageSize_ + stats.PageWaste_ == config.PageBytes_ ? "yes" : "no" )
+         << ", One more block fits: " << ( oneMore->GetStats().PageSize_ <= config.PageBytes_ ? "yes" : "no" ) << endl;
+    delete oneMore;
+    delete oa;
+}
+
+void TestPageBytes( void )
+{
+    OAConfig plain( false, 1, 0 );
+    plain.PageBytes_ = 4096;
+    PrintPageBytes( "4 KiB, 100 bytes", 100, plain );
+    PrintPageBytes( "4 KiB, 8 bytes", 8, plain );
+    PrintPageBytes( "4 KiB, 5000 bytes", 5000, plain );
+
+    // Pads, headers, their checksum and alignment all count
+    OAConfig debug( false, 1, 0, true, 4, OAConfig::HeaderBlockInfo( OAConfig::hbExtended, 4 ), 16, true );
+    debug.PageBytes_ = 4096;
+    PrintPageBytes( "4 KiB, 100 bytes, debug", 100, debug );
+    debug.PageBytes_ = 64 * 1024;
+    PrintPageBytes( "64 KiB, Student, debug", sizeof( Student ), debug );
+    plain.PageBytes_ = 2 * 1024 * 1024;
+    PrintPageBytes( "2 MiB, Student", sizeof( Student ), plain );
+
+    // Pages fill up at the computed count, and take exactly the target from the PageHeap
+    ObjectAllocator *oa = 0;
+    try {
+        OAConfig config( false, 1, 0 );
+        config.PageBytes_ = 64 * 1024;
+        config.UsePageHeap_ = true;
+        oa = new ObjectAllocator( 1000, config );
+        cout << "PageHeap bytes in use for one page: " << PageHeap::BytesInUse() << endl;
+        unsigned perPage = oa->GetConfig().ObjectsPerPage_;
+        for( unsigned i = 0; i < perPage; i++ )
+            oa->Allocate();
+        PrintCounts( oa );
+        oa->Allocate();
+        PrintCounts( oa );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestPageBytes."  << endl;
+    }
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+unsigned CountNotZeroed( void **blocks, unsigned count, size_t size )
+{
+    unsigned dirty = 0;
+    for( unsigned i = 0; i < count; i++ ) {
+        const unsigned char *bytes = static_cast<const unsigned char *>( blocks[i] );
+        for( size_t j = 0; j < size; j++ )
+            if( bytes[j] ) {
+                dirty++;
+                break;
+            }
+    }
+    return dirty;
+}
+
+void TestZeroedShadow( void )
+{
+    ObjectAllocator *oa = 0;
+    const unsigned count = 24;
+    void *blocks[count];
+    try {
+        OAConfig config( false, 4, 0 );
+        oa = new ObjectAllocator( sizeof( Employee ), config );
+
+        // Leave garbage behind on both paths
+        oa->SetShadowMode( 1.0 );
+        for( unsigned i = 0; i < count; i++ ) {
+            blocks[i] = oa->Allocate();
+            memset( blocks[i], 0xAB, sizeof( Employee ) );
+        }
+        for( unsigned i = 0; i < count; i++ )
+            oa->Free( blocks[i] );
+        oa->SetShadowMode( 0 );
+        for( unsigned i = 0; i < count; i++ ) {
+            blocks[i] = oa->Allocate();
+            memset( blocks[i], 0xAB, sizeof( Employee ) );
+        }
+        for( unsigned i = 0; i < count; i++ )
+            oa->Free( blocks[i] );
+        cout << "Blocks zeroed ahead: " << oa->ZeroFreeObjects( count / 2 ) << endl;
+
+        // Half of them come from the zeroed list, the rest have to be cleared
+        oa->SetShadowMode( 0.5 );
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = oa->AllocateZeroed();
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestZeroedShadow."  << endl;
+        delete oa;
+        return;
+    }
+
+    cout << "Blocks not zeroed: " << CountNotZeroed( blocks, count, sizeof( Employee ) ) << endl;
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( blocks[i] );
+    oa->SetShadowMode( 0 );
+    cout << "Objects in use: " << oa->GetStats().ObjectsInUse_ << endl;
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void PrintShadowCounts( const ObjectAllocator *oa )
+{
+    OAShadowStats stats = oa->GetShadowStats();
+    cout << "Shadowed allocs: " << stats.Pool_.Allocations_ + stats.NewDelete_.Allocations_;
+    cout << ", Shadowed frees: " << stats.Pool_.Deallocations_ + stats.NewDelete_.Deallocations_;
+    cout << ", Shadowed in use: " << stats.Pool_.ObjectsInUse_ + stats.NewDelete_.ObjectsInUse_ << endl;
+}
+
+void TestShadowCounts( void )
+{
+    ObjectAllocator *oa = 0;
+    SharedAllocator *shared = 0;
+    const unsigned before = 6, count = 20;
+    void *early[before], *blocks[count];
+    try {
+        OAConfig config( false, 4, 0 );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        for( unsigned i = 0; i < before; i++ )
+            early[i] = oa->Allocate();
+        oa->SetShadowMode( 0.5 );
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = oa->Allocate();
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestShadowCounts."  << endl;
+        delete oa;
+        return;
+    }
+
+    // Blocks from before the mode was on don't count on either path
+    for( unsigned i = 0; i < before; i++ )
+        oa->Free( early[i] );
+    PrintShadowCounts( oa );
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( blocks[i] );
+    PrintShadowCounts( oa );
+    oa->SetShadowMode( 0 );
+    cout << "Objects in use: " << oa->GetStats().ObjectsInUse_ << ", Frees: " << oa->GetStats().Deallocations_ << endl;
+    delete oa;
+
+    // Synchronized pool growing outside of its lock
+    try {
+        OAConfig config( false, 4, 0 );
+        shared = new SharedAllocator( sizeof( Student ), config );
+        shared->Unsynchronized().SetShadowMode( 0.5 );
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = shared->Allocate();
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestShadowCounts."  << endl;
+        delete shared;
+        return;
+    }
+    PrintShadowCounts( &shared->Unsynchronized() );
+    for( unsigned i = 0; i < count; i++ )
+        shared->Free( blocks[i] );
+    PrintShadowCounts( &shared->Unsynchronized() );
+    cout << "Objects in use: " << shared->Unsynchronized().GetStats().ObjectsInUse_ << endl;
+    delete shared;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void PrintFreeError( const OAException& e, const char *test )
+{
+    if( e.code() == e.E_BAD_BOUNDARY )
+        cout << "Exception thrown from Free: E_BAD_BOUNDARY" << endl;
+    else if( e.code() == e.E_BAD_ADDRESS )
+        cout << "Exception thrown from Free: E_BAD_ADDRESS" << endl;
+    else if( e.code() == e.E_MULTIPLE_FREE )
+        cout << "Exception thrown from Free: E_MULTIPLE_FREE" << endl;
+    else if( e.code() == e.E_CORRUPTED_BLOCK )
+        cout << "Exception thrown from Free: E_CORRUPTED_BLOCK" << endl;
+    else
+        cout << "****** Unknown OAException thrown from Free in " << test << ". ******" << endl;
+}
+
+void OAFreeBlocks( void **blocks, unsigned count )
+{
+    for( unsigned i = 0; i < count; i++ )
+        oa::Free( blocks[i] );
+}
+
+void TestShadowOAFree( void )
+{
+    ObjectAllocator *oa = 0;
+    const unsigned count = 20;
+    void *blocks[count];
+    try {
+        OAConfig config( false, 4, 0 );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        oa->SetShadowMode( 0.5 );
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = oa->Allocate();
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestShadowOAFree."  << endl;
+        delete oa;
+        return;
+    }
+
+    // Blocks from either path are found through the PageMap
+    unsigned found = 0;
+    for( unsigned i = 0; i < count; i++ )
+        if( PageMap::Find( blocks[i] ) == oa )
+            found++;
+    cout << "Blocks found: " << found << endl;
+    OAFreeBlocks( blocks, count );
+    PrintShadowCounts( oa );
+    cout << "Objects in use: " << oa->GetStats().ObjectsInUse_ << ", Frees: " << oa->GetStats().Deallocations_ << endl;
+
+    // Every block from new/delete, freed by two other threads while frees are deferred
+    oa->SetShadowMode( 1.0 );
+    for( unsigned i = 0; i < count; i++ )
+        blocks[i] = oa->Allocate();
+    oa->SetDeferredFree( true );
+    std::thread first( OAFreeBlocks, blocks, count / 2 );
+    std::thread second( OAFreeBlocks, blocks + count / 2, count / 2 );
+    first.join();
+    second.join();
+    PrintShadowCounts( oa );
+    cout << "Objects in use: " << oa->GetStats().ObjectsInUse_ << ", Frees: " << oa->GetStats().Deallocations_ << endl;
+    oa->SetDeferredFree( false );
+    oa->SetShadowMode( 0 );
+    cout << "Objects in use: " << oa->GetStats().ObjectsInUse_ << ", Allocs: " << oa->GetStats().Allocations_ << endl;
+
+    Student local;
+    try {
+        oa::Free( &local );
+        cout << "Freed a block no allocator owns." << endl;
+    } catch( const OAException& e ) {
+        PrintFreeError( e, "TestShadowOAFree" );
+    }
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void TestPoolContainers( void )
+{
+    try {
+        // Keys that are multiples of 64K, like aligned addresses
+        const unsigned count = 20000;
+        PoolHashMap<unsigned, unsigned> map;
+        for( unsigned i = 0; i < count; i++ )
+            map.Insert( i << 16, i );
+        unsigned found = 0;
+        for( unsigned i = 0; i < count; i++ ) {
+            unsigned *value = map.Find( i << 16 );
+            if( value && *value == i )
+                found++;
+        }
+        cout << "Keys found: " << found << " of " << map.Size() << endl;
+        cout << "Longest run under 256: " << ( map.LongestRun() < 256 ? "yes" : "no" ) << endl;
+        for( unsigned i = 0; i < count; i += 2 )
+            map.Erase( i << 16 );
+        found = 0;
+        for( unsigned i = 0; i < count; i++ )
+            if( map.Find( i << 16 ) )
+                found++;
+        cout << "Keys left: " << found << " of " << map.Size() << endl;
+
+        // Slots of erased nodes are used again
+        PoolList<Employee> staff( 16 );
+        Employee employee;
+        Slot highest = 0;
+        for( unsigned i = 0; i < 64; i++ ) {
+            FillEmployee( employee );
+            staff.PushBack( employee );
+        }
+        for( Slot slot = staff.First(); slot != NULL_SLOT; ) {
+            slot = staff.Erase( slot );
+            if( slot != NULL_SLOT )
+                slot = staff.Next( slot );
+        }
+        for( unsigned i = 0; i < 32; i++ ) {
+            FillEmployee( employee );
+            Slot slot = staff.PushFront( employee );
+            if( slot > highest )
+                highest = slot;
+        }
+        cout << "List size: " << staff.Size() << ", highest slot: " << highest << endl;
+        PrintCounts( &staff.Allocator() );
+
+        PoolQueue<unsigned> queue( 6 );
+        unsigned queued = 0, value, inOrder = 0;
+        while( queue.TryEnqueue( queued ) )
+            queued++;
+        for( unsigned i = 0; queue.TryDequeue( value ); i++ )
+            if( value == i )
+                inOrder++;
+        cout << "Queue capacity: " << queue.Capacity() << ", queued: " << queued << ", in order: " << inOrder << endl;
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestPoolContainers."  << endl;
+    }
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void TestReservedPages( void )
+{
+    ObjectAllocator *oa = 0;
+    const unsigned count = 12;
+    Student *students[count];
+    try {
+        OAConfig::HeaderBlockInfo header( OAConfig::hbBasic );
+        OAConfig config( false, 4, 3, true, 0, header, 0, false, true );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        for( unsigned i = 0; i < count; i++ )
+            students[i] = static_cast<Student *>( oa->Allocate() );
+        PrintCounts( oa );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestReservedPages."  << endl;
+        delete oa;
+        return;
+    }
+
+    try {
+        oa->Allocate();
+        cout << "Allocated past max pages." << endl;
+    } catch( const OAException& e ) {
+        if( e.code() == e.E_NO_PAGES )
+            cout << "Exception thrown from Allocate: E_NO_PAGES" << endl;
+        else
+            cout << "****** Unknown OAException thrown from Allocate in TestReservedPages. ******" << endl;
+    }
+
+    // Blocks are found by their index in the range
+    unsigned matching = 0;
+    for( unsigned i = 0; i < count; i++ )
+        if( oa->Owns( students[i] ) && oa->BlockAt( oa->BlockIndex( students[i] ) ) == students[i] )
+            matching++;
+    cout << "Blocks found by index: " << matching << endl;
+    try {
+        oa->Free( reinterpret_cast<char *>( students[0] ) + 4 );
+        cout << "Freed a block at a bad boundary." << endl;
+    } catch( const OAException& e ) {
+        PrintFreeError( e, "TestReservedPages" );
+    }
+    Student local;
+    try {
+        oa->Free( &local );
+        cout << "Freed a block that isn't on any page." << endl;
+    } catch( const OAException& e ) {
+        PrintFreeError( e, "TestReservedPages" );
+    }
+
+    // The slot of an empty page is decommitted and used again first
+    size_t firstIndex = oa->BlockIndex( students[4] ) - oa->BlockIndex( students[4] ) % 4;
+    for( unsigned i = 0; i < count; i++ )
+        if( oa->BlockIndex( students[i] ) / 4 == firstIndex / 4 )
+            oa->Free( students[i] );
+    cout << "Empty pages freed: " << oa->FreeEmptyPages() << endl;
+    PrintCounts( oa );
+    Student *again = static_cast<Student *>( oa->Allocate() );
+    cout << "Slot used again: " << ( oa->BlockIndex( again ) / 4 == firstIndex / 4 ? "yes" : "no" ) << endl;
+    cout << "Blocks validated: " << oa->ValidatePages( ValidateCallback ) << endl;
+    PrintCounts( oa );
+    delete oa;
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+bool IsInAddressOrder( void **blocks, unsigned count )
+{
+    for( unsigned i = 1; i < count; i++ )
+        if( blocks[i] <= blocks[i - 1] )
+            return false;
+    return true;
+}
+
+void SortAndCheck( ObjectAllocator *oa, bool isAutoSorted )
+{
+    const unsigned count = 24;
+    void *blocks[count];
+    for( unsigned i = 0; i < count; i++ )
+        blocks[i] = oa->Allocate();
+
+    // Give them back out of order
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( blocks[( i * 7 ) % count] );
+    if( !isAutoSorted ) {
+        for( unsigned i = 0; i < count; i++ )
+            blocks[i] = oa->Allocate();
+        cout << "Unsorted in address order: " << ( IsInAddressOrder( blocks, count ) ? "yes" : "no" ) << endl;
+        for( unsigned i = 0; i < count; i++ )
+            oa->Free( blocks[( i * 7 ) % count] );
+        cout << "Free blocks sorted: " << oa->SortFreeList() << endl;
+    }
+    for( unsigned i = 0; i < count; i++ )
+        blocks[i] = oa->Allocate();
+    cout << "Sorted in address order: " << ( IsInAddressOrder( blocks, count ) ? "yes" : "no" ) << endl;
+    for( unsigned i = 0; i < count; i++ )
+        oa->Free( blocks[i] );
+    PrintCounts( oa );
+}
+
+void TestSortFreeList( void )
+{
+    ObjectAllocator *oa = 0;
+    for( unsigned reserved = 0; reserved < 2; reserved++ ) {
+        try {
+            OAConfig config( false, 8, 0, false, 0, OAConfig::HeaderBlockInfo(), 0, false, reserved != 0 );
+            oa = new ObjectAllocator( sizeof( Student ), config );
+            cout << ( reserved ? "Reserved address space" : "Pages from new[]" ) << endl;
+            SortAndCheck( oa, false );
+            oa->SetAutoSortFreeList( 24 );
+            SortAndCheck( oa, true );
+            oa->SetAutoSortFreeList( 0 );
+        } catch( const OAException& e ) {
+            if( SHOW_EXCEPTIONS )
+                cout << e.what() << endl;
+            else
+                cout << "Exception thrown during construction/allocation in TestSortFreeList."  << endl;
+        }
+        delete oa;
+        oa = 0;
+    }
+}
+
+//****************************************************************************************************
+//****************************************************************************************************
+void FreeAndCheck( ObjectAllocator *oa, void *block, const char *what, const char *test )
+{
+    try {
+        oa->Free( block );
+        cout << "Freed " << what << "." << endl;
+    } catch( const OAException& e ) {
+        PrintFreeError( e, test );
+    }
+}
+
+void TestDebugAtRuntime( void )
+{
+    ObjectAllocator *oa = 0;
+    const unsigned count = 8;
+    Student *students[count];
+    try {
+        OAConfig config( false, 4, 0, false, 4 );
+        oa = new ObjectAllocator( sizeof( Student ), config );
+        for( unsigned i = 0; i < count; i++ )
+            students[i] = static_cast<Student *>( oa->Allocate() );
+        PrintCounts( oa );
+    } catch( const OAException& e ) {
+        if( SHOW_EXCEPTIONS )
+            cout << e.what() << endl;
+        else
+            cout << "Exception thrown during construction/allocation in TestDebugAtRuntime."  << endl;
+        delete oa;
+        return;
+    }
+
+    // Freed (and one zeroed) before there are any patterns
+    oa->Free( students[0] );
+    oa->Free( students[1] );
+    cout << "Blocks zeroed: " << oa->ZeroFreeObjects( 1 ) << endl;
+
+    AllocatorControl::Register( "runtime", *oa );
+    std::string value;
+    bool isWritten = AllocatorControl::Control( "pool.runtime.debug", &value, "1" );
+    cout << "Debug was " << value << ", written: " << ( isWritten ? "yes" : "no" ) << endl;
+    AllocatorControl::Control( "pool.runtime.debug", &value );
+    cout << "Debug is " << value << endl;
+    unsigned corrupted = oa->ValidatePages( ValidateCallback );
+    cout << "Corrupted blocks: " << corrupted << endl;
+
+    FreeAndCheck( oa, students[2], "a block allocated before debug", "TestDebugAtRuntime" );
+    FreeAndCheck( oa, students[2], "the same block again", "TestDebugAtRuntime" );
+    FreeAndCheck( oa, students[0], "a block freed before debug", "TestDebugAtRuntime" );
+    FreeAndCheck( oa, students[1], "a block zeroed before debug", "TestDebugAtRuntime" );
+    FreeAndCheck( oa, reinterpret_cast<char *>( students[3] ) + 1, "a block at a bad boundary", "TestDebugAtRuntime" );
+    reinterpret_cast<unsigned char *>( students[3] )[sizeof( Student )] = 0;
+    corrupted = oa->ValidatePages( ValidateCallback );
+    cout << "Corrupted blocks: " << corrupted << endl;
+    FreeAndCheck( oa, students[3], "a block with a bad pad", "TestDebugAtRuntime" );
+    for( unsigned i = 4; i < count; i++ )
+        oa->Free( students[i] );
+    students[0] = static_cast<Student *>( oa->Allocate() );
+    oa->Free( students[0] );
+    PrintCounts( oa );
+    AllocatorControl::Unregister( "runtime" );
+    delete oa;
+}
+
+void PrintCounts( const ObjectAllocator *nm )
+{
+    OAStats stats = nm->GetStats();
+    cout << "Pages in use: " << stats.PagesInUse_;
+    cout << ", Objects in use: " << stats.ObjectsInUse_;
+    cout << ", Available objects: " << stats.FreeObjects_;
+    cout << ", Allocs: " << stats.Allocations_;
+    cout << ", Frees: " << stats.Deallocations_ << endl;
+}
+
+void PrintCounts2( const ObjectAllocator *nm )
+{
+    OAStats stats = nm->GetStats();
+    cout << "Allocs: " << stats.Allocations_;
+    cout << ", Frees: " << stats.Deallocations_ << endl;
+}
+
+void PrintConfig( const ObjectAllocator *oa )
+{
+    cout << "Object size = " << oa->GetStats().ObjectSize_;
+    cout << ", Page size = " << oa->GetStats().PageSize_;
+    cout << ", Pad bytes = " << oa->GetConfig().PadBytes_;
+    cout << ", ObjectsPerPage = " << oa->GetConfig().ObjectsPerPage_;
+    cout << ", MaxPages = " << oa->GetConfig().MaxPages_;
+    cout << ", MaxObjects = " <<  oa->GetConfig().ObjectsPerPage_ * oa->GetConfig().MaxPages_;
+    cout << endl;
+    cout << "Alignment = " << oa->GetConfig().Alignment_;
+    cout << ", LeftAlign = " << oa->GetConfig().LeftAlignSize_;
+    cout << ", InterAlign = " << oa->GetConfig().InterAlignSize_;
+    cout << ", HeaderBlocks = ";
+    if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbNone )
+        cout << "None";
+    else if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbBasic )
+        cout << "Basic";
+    else if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbExtended )
+        cout << "Extended";
+    else if( oa->GetConfig().HBlockInfo_.type_ == OAConfig::hbExternal )
+        cout << "External";
+    cout << ", Header size = " << oa->GetConfig().HBlockInfo_.size_;
+    cout << endl;
+}
+
+void DumpPages( const ObjectAllocator *nm, unsigned width )
+{
+    const unsigned char *pages = static_cast<const unsigned char *>( nm->GetPageList() );
+    const unsigned char *realpage = pages;
+    size_t header_size = nm->GetConfig().HBlockInfo_.size_;
+    while( pages ) {
+        unsigned count = 0;
+        if( SHOWREAL )
+            printf( "%p\n", pages );
+        else
+            printf( "XXXXXXXX\n" );
+        // print column header
+        for( unsigned j = 0; j < width; j++ )
+            printf( " %2i", j );
+        printf( "\n" );
+        // "Next page" pointer in the page
+        if( SHOWREAL ) {
+            for( unsigned i = 0; i < sizeof( void * ); i++, count++ )
+                printf( " %02X", *pages++ );
+        } else {
+            for( unsigned j = 0; j < sizeof( void * ); pages++, count++, j++ )
+                printf( " %s", "XX" );
+        }
+        // Left leading alignment bytes
+        if( nm->GetConfig().Alignment_ > 1 ) {
+            // leading alignment block (if any)
+            for( unsigned j = 0; j < nm->GetConfig().LeftAlignSize_; count++, j++ ) {
+                if( count >= width ) {
+                    printf( "\n" );
+                    count = 0;
+                }
+                printf( " %02X", *pages++ );
+            }
+        }
+        // Dump each object and its associated info
+        for( unsigned int i = 0; i < nm->GetConfig().ObjectsPerPage_ ; i++ ) {
+            // inter-block alignment (not on first block)
+            if( i > 0 ) {
+                for( unsigned j = 0; j < nm->GetConfig().InterAlignSize_; count++, j++ ) {
+                    if( count >= width ) {
+                        printf( "\n" );
+                        count = 0;
+                    }
+                    printf( " %02X", *pages++ );
+                }
+            }
+            // header block bytes
+            for( unsigned j = 0; j < header_size; count++, j++ ) {
+                if( count >= width ) {
+                    printf( "\n" );
+                    count = 0;
+                }
+                printf( " %02X", *pages++ );
+            }
+            // left padding
+            for( unsigned j = 0; j < nm->GetConfig().PadBytes_; count++, j++ ) {
+                if( count >= width ) {
+                    printf( "\n" );
+                    count = 0;
+                }
+                printf( " %02X", *pages++ );
+            }
+            // possible next pointer (zero it out)
+            for( unsigned j = 0; j < sizeof( void * ); count++, pages++, j++ ) {
+                if( count >= width ) {
+                    printf( "\n" );
+                    count = 0;
+                }
+                if( SHOWREAL )
+                    printf( " %02X", *pages );
+                else
+                    printf( " %s", "XX" );
+            }
+            // remaining bytes
+            for( unsigned j = 0; j < nm->GetStats().ObjectSize_ - sizeof( void * ); count++, j++ ) {
+                if( count >= width ) {
+                    printf( "\n" );
+                    count = 0;
+                }
+                printf( " %02X", *pages++ );
+            }
+            // right pad bytes
+            for( unsigned j = 0; j < nm->GetConfig().PadBytes_; count++, j++ ) {
+                if( count >= width ) {
+                    printf( "\n" );
+                    count = 0;
+                }
+                printf( " %02X", *pages++ );
+            }
+        }
+        printf( "\n\n" );
+        pages = reinterpret_cast<const unsigned char *>( ( reinterpret_cast<const GenericObject *>( realpage ) )->Next );
+        realpage = pages;
+    }
+}
+
+void DumpExternalHeaders( const ObjectAllocator *oa, const unsigned char *p )
+{
+    unsigned char *page = const_cast<unsigned char *>( p );
+    unsigned padbytes = oa->GetConfig().PadBytes_;
+    size_t header_size = oa->GetConfig().HBlockInfo_.size_;
+    unsigned leftalign = oa->GetConfig().LeftAlignSize_;
+    unsigned interalign = oa->GetConfig().InterAlignSize_;
+    unsigned count = oa->GetConfig().ObjectsPerPage_;
+    size_t offset = padbytes * 2 + header_size + interalign + oa->GetStats().ObjectSize_;
+    page += sizeof( void * ); // the 'next' pointer
+    page += leftalign;      // the left alignment bytes (if any)
+    // We're now pointing at the beginning of the header block
+    MemBlockInfo *pm = reinterpret_cast<MemBlockInfo *>( *reinterpret_cast<MemBlockInfo **>( page ) );
+    cout << "  Label: " << ( pm && pm->label ? pm->label : "" ) << std::endl;
+    cout << " In use: " << ( pm ? pm->in_use : 0 ) << std::endl;
+    cout << "Alloc #: " << ( pm && pm->in_use ? pm->alloc_num : 0 ) << std::endl;
+    for( unsigned i = 1; i < count; i++ ) {
+        page += offset;
+        MemBlockInfo *pm = reinterpret_cast<MemBlockInfo *>( *reinterpret_cast<MemBlockInfo **>( page ) );
+        cout << "  Label: " << ( pm && pm->label ? pm->label : "" ) << std::endl;
+        cout << " In use: " << ( pm ? pm->in_use : 0 ) << std::endl;
+        cout << "Alloc #: " << ( pm && pm->in_use ? pm->alloc_num : 0 ) << std::endl;
+    }
+}
+
+void DumpPagesEx( const ObjectAllocator *nm, unsigned width )
+{
+    const unsigned char *pages = static_cast<const unsigned char *>( nm->GetPageList() );
+    const unsigned char *realpage = pages;
+    size_t header_size = nm->GetConfig().HBlockInfo_.size_;
+    while( pages ) {
+        unsigned count = 0;
+        if( SHOWREAL )
+            printf( "%p\n", pages );
+        else
+            printf( "XXXXXXXX\n" );
+        // print column header
+        for( unsigned j = 0; j < width; j++ )
+            printf( " %2i", j );
+        printf( "\n" );
+        if( SHOWREAL ) {
+            for( unsigned i = 0; i < sizeof( void * ); i++, count++ )
+                printf( " %02X", *pages++ );
+        } else {
+            for( unsigned j = 0; j < sizeof( void * ); pages++, count++, j++ )
+                printf( " %s", "XX" );
         }
         // Left leading alignment bytes
         if( nm->GetConfig().Alignment_ > 1 ) {
@@ -1734,7 +3423,33 @@ int main( int argc, char **argv )
         {TestFreeEmptyPages2,      max,    safe   }, // 21 extra credit only
         {TestFreeEmptyPages3,      max,    safe   }, // 22 extra credit only
     };
+    // Features on top of the assignment start at 31, 30 is the sentinel file
+    TimedTest ExtendedTests[] = {{TestMarkSweep,            max,    safe   }, // 31
+        {TestHeaderChecksum,       max,    safe   }, // 32
+        {TestDeferredFree,         max,    safe   }, // 33
+        {TestAllocateWait,         max,    safe   }, // 34
+        {TestPageMap,              max,    safe   }, // 35
+        {TestPooledObject,         max,    safe   }, // 36
+        {TestZeroedShadow,         max,    safe   }, // 37
+        {TestShadowCounts,         max,    safe   }, // 38
+        {TestPoolContainers,       max,    safe   }, // 39
+        {TestReservedPages,        max,    safe   }, // 40
+        {TestSortFreeList,         max,    safe   }, // 41
+        {TestDebugAtRuntime,       max,    safe   }, // 42
+        {TestShadowOAFree,         max,    safe   }, // 43
+        {TestThreadCache,          max,    safe   }, // 44
+        {TestCoroutineFrames,      max,    safe   }, // 45
+        {TestIOBufferPool,         max,    safe   }, // 46
+        {TestAllocatorControl,     max,    safe   }, // 47
+        {TestColdPages,            max,    safe   }, // 48
+        {TestDirtyPages,           max,    safe   }, // 49
+        {TestValidateThreads,      max,    safe   }, // 50
+        {TestLockPolicies,         max,    safe   }, // 51
+        {TestPageHeap,             max,    safe   }, // 52
+        {TestPageBytes,            max,    safe   }, // 53
+    };
     int num = sizeof( Tests ) / sizeof( *Tests );
+    int extended = sizeof( ExtendedTests ) / sizeof( *ExtendedTests );
     if( test_num == 30 ) {
         Test20(); // create sentinel file
         return 0;
@@ -1742,8 +3457,12 @@ int main( int argc, char **argv )
     if( test_num == 0 ) {
         for( int i = 0; i < num; i++ )
             ExecuteTest( Tests[i].test, Tests[i].maxwait, Tests[i].safewait );
+        for( int i = 0; i < extended; i++ )
+            ExecuteTest( ExtendedTests[i].test, ExtendedTests[i].maxwait, ExtendedTests[i].safewait );
     } else if( test_num > 0 && test_num <= num ) {
         ExecuteTest( Tests[test_num - 1].test, Tests[test_num - 1].maxwait, Tests[test_num - 1].safewait );
+    } else if( test_num > 30 && test_num <= 30 + extended ) {
+        ExecuteTest( ExtendedTests[test_num - 31].test, ExtendedTests[test_num - 31].maxwait, ExtendedTests[test_num - 31].safewait );
     }
     return 0;
 }